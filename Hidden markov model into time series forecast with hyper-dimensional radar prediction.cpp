@@ -5,11 +5,18 @@
 #include <algorithm>
 #include <iomanip>
 #include <map>
+#include <limits>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+
+#include "KMeansRestarts.h"
 
 // Hidden Markov Model Components
 class HiddenMarkovModel {
 public:
-    std::vector<std::vector<double>> transition_matrix; // State transition probabilities
+    std::vector<std::vector<double>> transition_matrix; // State transition probabilities; call
+                                                        // transitions_changed() after editing directly
     std::vector<double> state_probabilities; // Initial state probabilities
     std::vector<std::vector<double>> emission_matrix; // Emission probabilities (observed)
 
@@ -31,8 +38,18 @@ public:
                 val /= sum; // Normalize
             }
         }
+        transitions_changed();
+    }
+
+    // Set one transition probability
+    void set_transition(int from, int to, double value) {
+        transition_matrix[from][to] = value;
+        transitions_changed();
     }
 
+    // Invalidate the cached transition powers used by forecast()
+    void transitions_changed() { powers_dirty = true; }
+
     // Predict next state based on current state and observations
     int predict_next_state(int current_state, int observation) {
         double random_val = static_cast<double>(rand()) / RAND_MAX;
@@ -45,6 +62,90 @@ public:
         }
         return current_state; // If no change
     }
+
+    // Distribution over states `horizon` steps ahead of the given distribution: p * A^horizon.
+    // A^horizon is never formed; p is multiplied by the cached powers A^(2^i) for each set bit
+    // of the horizon, so any horizon costs O(log horizon) vector-matrix products.
+    std::vector<double> forecast(const std::vector<double>& distribution, uint64_t horizon) {
+        check_distribution(distribution);
+        refresh_power_cache(horizon);
+        std::vector<double> result = distribution;
+        std::vector<double> scratch(result.size());
+        for (size_t bit = 0; horizon >> bit; ++bit) {
+            if ((horizon >> bit) & 1) {
+                multiply_vector(result, transition_powers[bit], scratch);
+                result.swap(scratch);
+            }
+        }
+        return result;
+    }
+
+    // Forecasts for several horizons (e.g. for plotting); horizons are visited in increasing
+    // order and each one advances from the previous forecast by the difference
+    std::vector<std::vector<double>> forecast_batch(const std::vector<double>& distribution,
+                                                    const std::vector<uint64_t>& horizons) {
+        check_distribution(distribution);
+        std::vector<size_t> order(horizons.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return horizons[a] < horizons[b]; });
+
+        std::vector<std::vector<double>> results(horizons.size());
+        std::vector<double> current = distribution;
+        uint64_t reached = 0;
+        for (size_t index : order) {
+            current = forecast(current, horizons[index] - reached);
+            reached = horizons[index];
+            results[index] = current;
+        }
+        return results;
+    }
+
+private:
+    // transition_powers[i] = A^(2^i) as flat row-major matrices; rebuilt once powers_dirty is set
+    std::vector<std::vector<double>> transition_powers;
+    bool powers_dirty = true;
+
+    void check_distribution(const std::vector<double>& distribution) const {
+        if (distribution.size() != transition_matrix.size()) {
+            throw std::invalid_argument("Distribution size does not match the number of states.");
+        }
+    }
+
+    // Extend the cache up to the highest bit of horizon, rebuilding it if the matrix changed
+    void refresh_power_cache(uint64_t horizon) {
+        size_t n = transition_matrix.size();
+        if (powers_dirty) {
+            powers_dirty = false;
+            transition_powers.assign(1, std::vector<double>(n * n));
+            for (size_t i = 0; i < n; ++i) {
+                std::copy(transition_matrix[i].begin(), transition_matrix[i].end(), transition_powers[0].begin() + i * n);
+            }
+        }
+        while (horizon >> transition_powers.size()) {
+            const std::vector<double>& last = transition_powers.back();
+            std::vector<double> squared(n * n, 0.0);
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t k = 0; k < n; ++k) {
+                    double a = last[i * n + k];
+                    for (size_t j = 0; j < n; ++j) {
+                        squared[i * n + j] += a * last[k * n + j];
+                    }
+                }
+            }
+            transition_powers.push_back(std::move(squared));
+        }
+    }
+
+    // out = v * M for a flat row-major n x n matrix
+    static void multiply_vector(const std::vector<double>& v, const std::vector<double>& matrix, std::vector<double>& out) {
+        size_t n = v.size();
+        std::fill(out.begin(), out.end(), 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                out[j] += v[i] * matrix[i * n + j];
+            }
+        }
+    }
 };
 
 // Chakra Class to model energy states and quantum vectors
@@ -83,24 +184,43 @@ std::vector<double> cross_product(const std::vector<double>& v1, const std::vect
 }
 
 // Poisson Distribution to simulate chakra energy jumps
+// The generator and the distribution (rebuilt only when lambda changes) persist per thread
 int poisson_jump(double lambda) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::poisson_distribution<> d(lambda);
+    if (!std::isfinite(lambda) || lambda < 0.0) {
+        throw std::invalid_argument("Poisson rate must be finite and non-negative.");
+    }
+    if (lambda == 0.0) return 0;
+    thread_local std::mt19937 gen(std::random_device{}()); // Seeded once per thread
+    thread_local std::poisson_distribution<> d(lambda);
+    if (d.mean() != lambda) {
+        d = std::poisson_distribution<>(lambda);
+    }
     return d(gen);
 }
 
-// K-means clustering algorithm (simple implementation)
-std::vector<int> kmeans_clustering(const std::vector<std::vector<double>>& data, int k, int max_iters = 100) {
+// Labels and inertia (sum of squared distances to assigned centroids) of one k-means run
+struct KMeansLabels {
+    std::vector<int> labels;
+    double inertia = std::numeric_limits<double>::infinity();
+};
+
+// Single k-means run, centroids initialised from data points chosen by the given seed
+KMeansLabels kmeans_single(const std::vector<std::vector<double>>& data, int k, int max_iters, uint64_t seed) {
     int n = data.size(); // Number of points
-    std::vector<std::vector<double>> centroids(k, std::vector<double>(data[0].size(), 0.0)); // k centroids
-    std::vector<int> labels(n, 0); // Cluster labels
+    std::vector<std::vector<double>> centroids(k); // k centroids
+    KMeansLabels result;
+    result.labels.assign(n, 0); // Cluster labels
 
     // Initialize centroids randomly from data points
-    std::random_shuffle(centroids.begin(), centroids.end());
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<> pick(0, n - 1);
+    for (auto& centroid : centroids) {
+        centroid = data[pick(gen)];
+    }
 
-    for (int iter = 0; iter < max_iters; ++iter) {
+    for (int iter = 0; iter <= max_iters; ++iter) {
         // Assign labels
+        result.inertia = 0.0;
         for (int i = 0; i < n; ++i) {
             double min_dist = std::numeric_limits<double>::max();
             for (int j = 0; j < k; ++j) {
@@ -110,10 +230,12 @@ std::vector<int> kmeans_clustering(const std::vector<std::vector<double>>& data,
                 }
                 if (dist < min_dist) {
                     min_dist = dist;
-                    labels[i] = j;
+                    result.labels[i] = j;
                 }
             }
+            result.inertia += min_dist;
         }
+        if (iter == max_iters) break; // Final pass only scores the last centroids
 
         // Update centroids
         std::vector<std::vector<double>> new_centroids(k, std::vector<double>(data[0].size(), 0.0));
@@ -121,22 +243,41 @@ std::vector<int> kmeans_clustering(const std::vector<std::vector<double>>& data,
 
         for (int i = 0; i < n; ++i) {
             for (size_t d = 0; d < data[i].size(); ++d) {
-                new_centroids[labels[i]][d] += data[i][d];
+                new_centroids[result.labels[i]][d] += data[i][d];
             }
-            count[labels[i]]++;
+            count[result.labels[i]]++;
         }
 
         for (int j = 0; j < k; ++j) {
+            if (count[j] == 0) {
+                new_centroids[j] = centroids[j]; // Keep empty clusters where they were
+                continue;
+            }
             for (size_t d = 0; d < data[0].size(); ++d) {
-                if (count[j] > 0)
-                    new_centroids[j][d] /= count[j];
+                new_centroids[j][d] /= count[j];
             }
         }
 
         centroids = new_centroids; // Update centroids
     }
 
-    return labels; // Return the cluster labels
+    return result;
+}
+
+// K-means clustering algorithm (simple implementation)
+// Runs n_init restarts concurrently over the shared data and returns the labels of the
+// lowest-inertia run; restart seeds come from run_restarts (restart 0 is kmeans_single with
+// `seed`), so results are reproducible and match the other k-means engines.
+std::vector<int> kmeans_clustering(const std::vector<std::vector<double>>& data, int k, int max_iters = 100,
+                                   int n_init = 1, uint64_t seed = std::random_device{}()) {
+    std::vector<KMeansLabels> runs = run_restarts<KMeansLabels>(
+        n_init, seed, [&](uint64_t run_seed) { return kmeans_single(data, k, max_iters, run_seed); });
+
+    size_t best = 0;
+    for (size_t r = 1; r < runs.size(); ++r) {
+        if (runs[r].inertia < runs[best].inertia) best = r;
+    }
+    return runs[best].labels; // Return the cluster labels
 }
 
 int main() {
@@ -144,6 +285,16 @@ int main() {
     HiddenMarkovModel hmm(3, 3);
     hmm.initialize_random();
 
+    // Forecast the state distribution from state 0 at several horizons
+    std::vector<double> start = {1.0, 0.0, 0.0};
+    std::vector<uint64_t> horizons = {1, 10, 1000000};
+    std::vector<std::vector<double>> forecasts = hmm.forecast_batch(start, horizons);
+    for (size_t h = 0; h < horizons.size(); ++h) {
+        std::cout << "Forecast " << horizons[h] << " steps ahead: ";
+        for (double p : forecasts[h]) std::cout << std::fixed << std::setprecision(3) << p << " ";
+        std::cout << std::endl;
+    }
+
     // Step 2: Create chakra units with random quantum vectors and energy levels
     Chakra chakra1({0.5, 0.3, 0.2}, 100.0);
     Chakra chakra2({0.6, 0.2, 0.1}, 120.0);
@@ -168,7 +319,7 @@ int main() {
 
     // Step 5: K-means clustering for chakra quantum vectors in 3D space
     std::vector<std::vector<double>> data = {chakra1.quantum_vector, chakra2.quantum_vector, cross_prod};
-    std::vector<int> cluster_labels = kmeans_clustering(data, 2);
+    std::vector<int> cluster_labels = kmeans_clustering(data, 2, 100, 4, 42);
 
     std::cout << "\nK-means Clustering Results:\n";
     for (size_t i = 0; i < cluster_labels.size(); ++i) {
@@ -8,46 +8,951 @@
 #include <numeric>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <cstdint>
+#include <limits>
+
+// Number of worker threads to use for a request of num_threads (0 = one per core)
+int effective_threads(int num_threads) {
+    if (num_threads > 0) return num_threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Run body(begin, end, worker) over [0, count) in blocks of `grain` items, handed out
+// dynamically to num_threads workers; the calling thread is worker 0. The first exception
+// thrown by body stops further blocks from being handed out and is rethrown once all
+// workers have joined.
+template <typename Body>
+void parallel_for(size_t count, size_t grain, int num_threads, Body body) {
+    int workers = std::min<size_t>(effective_threads(num_threads), (count + grain - 1) / std::max<size_t>(grain, 1));
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto run = [&](int worker) {
+        try {
+            for (size_t begin = next.fetch_add(grain); begin < count; begin = next.fetch_add(grain)) {
+                body(begin, std::min(begin + grain, count), worker);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+            next = count;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int w = 1; w < workers; ++w) {
+        threads.emplace_back(run, w);
+    }
+    run(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+// Posterior quantities from the forward-backward pass over one observation sequence
+struct HMMPosteriors {
+    std::vector<double> gamma;  // T x num_states, P(state_t = i | observations)
+    std::vector<double> xi_sum; // Sum over t of P(state_t = i, state_t+1 = j | observations), laid out
+                                // like the model's transition storage (dense or sparse values)
+    double log_likelihood = 0.0;
+};
+
+// Compressed sparse row (CSR) transition matrix; columns are sorted within each row
+struct SparseTransitions {
+    std::vector<size_t> row_offsets; // num_states + 1 entries
+    std::vector<int> columns;
+    std::vector<double> values;
+};
+
+// Small, fast xoshiro256** generator; one instance per thread replaces the global rand()
+struct FastRng {
+    uint64_t state[4];
+
+    explicit FastRng(uint64_t seed = 0x9E3779B97F4A7C15ull) { reseed(seed); }
+
+    // Expand one seed into the full state with splitmix64
+    void reseed(uint64_t seed) {
+        for (auto& word : state) {
+            seed += 0x9E3779B97F4A7C15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t operator()() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Uniform double in [0, 1)
+    double uniform() { return ((*this)() >> 11) * 0x1.0p-53; }
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+// Per-thread generator, seeded once per thread from random_device
+FastRng& thread_rng() {
+    thread_local FastRng rng(std::random_device{}() * 0x100000001ull ^ std::random_device{}());
+    return rng;
+}
+
+// Counter-based generator: a stateless hash of (key, counter), so every chain and step can be
+// drawn independently, in any order and in vectorized loops, with reproducible results
+inline uint64_t counter_hash(uint64_t key, uint64_t counter) {
+    uint64_t z = key + counter * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    z = (z ^ (z >> 32)) * 0xD6E8FEB86659FD93ull;
+    return z ^ (z >> 32);
+}
+
+// What simulate_chains records
+enum class ChainOutput {
+    Trajectories, // Every chain's state at every step
+    Occupancy     // Per-step histogram of chain states
+};
+
+// Output of a batch Markov chain simulation
+struct ChainSimulation {
+    std::vector<uint32_t> trajectories; // (steps + 1) x num_chains, step-major
+    std::vector<uint64_t> occupancy;    // (steps + 1) x num_states counts
+};
+
+// Baum-Welch training settings
+struct BaumWelchOptions {
+    int max_iterations = 100;
+    double tolerance = 1e-6; // Stop once the corpus log-likelihood improves by less than this
+    int num_threads = 0;     // 0 = one per core
+    int num_blocks = 32;     // Fixed E-step partition; results are identical for any thread count
+};
+
+// Outcome of Baum-Welch training
+struct BaumWelchResult {
+    std::vector<double> log_likelihoods; // Corpus log-likelihood before each M-step
+    int iterations = 0;
+    bool converged = false;
+};
+
+class OnlineHMMFilter;
 
 // Hidden Markov Model Components
 class HiddenMarkovModel {
+    friend class OnlineHMMFilter;
+
 public:
-    std::vector<std::vector<double>> transition_matrix; // State transition probabilities
-    std::vector<double> state_probabilities;            // Initial state probabilities
-    std::vector<std::vector<double>> emission_matrix;   // Emission probabilities (observed)
+    int num_states;
+    int num_observations;
+    std::vector<double> transition_matrix;   // State transition probabilities, row-major num_states x num_states
+    std::vector<double> state_probabilities; // Initial state probabilities
+    std::vector<double> emission_matrix;     // Emission probabilities, row-major num_states x num_observations
+    SparseTransitions sparse_transitions;    // Replaces transition_matrix (left empty) when is_sparse()
+
+    // Transitions are kept in CSR form when fewer than this fraction of entries are nonzero
+    static constexpr double kSparseDensity = 0.1;
+
+    HiddenMarkovModel(int num_states, int num_observations)
+        : num_states(num_states), num_observations(num_observations) {
+        transition_matrix.resize(static_cast<size_t>(num_states) * num_states, 0.0);
+        emission_matrix.resize(static_cast<size_t>(num_states) * num_observations, 0.0);
+        state_probabilities.resize(num_states, 0.0);
+    }
 
-    HiddenMarkovModel(int num_states, int num_observations) {
-        transition_matrix.resize(num_states, std::vector<double>(num_states, 0.0));
-        emission_matrix.resize(num_states, std::vector<double>(num_observations, 0.0));
+    // Model whose transitions start out in CSR form; the dense num_states x num_states matrix
+    // is never allocated, so large sparse models only cost memory for their nonzeros
+    HiddenMarkovModel(int num_states, int num_observations, SparseTransitions transitions)
+        : num_states(num_states), num_observations(num_observations) {
+        emission_matrix.resize(static_cast<size_t>(num_states) * num_observations, 0.0);
         state_probabilities.resize(num_states, 0.0);
+        set_sparse_transitions(std::move(transitions));
+    }
+
+    // Set one transition probability; inserting a new nonzero into a sparse model is O(nnz).
+    // Call transitions_changed() after a batch of edits.
+    void set_transition(int from, int to, double value) {
+        if (!sparse) {
+            transition_matrix[static_cast<size_t>(from) * num_states + to] = value;
+            return;
+        }
+        auto& csr = sparse_transitions;
+        auto first = csr.columns.begin() + csr.row_offsets[from];
+        auto last = csr.columns.begin() + csr.row_offsets[from + 1];
+        auto it = std::lower_bound(first, last, to);
+        size_t k = it - csr.columns.begin();
+        if (it != last && *it == to) {
+            csr.values[k] = value;
+            return;
+        }
+        csr.columns.insert(it, to);
+        csr.values.insert(csr.values.begin() + k, value);
+        for (int row = from + 1; row <= num_states; ++row) csr.row_offsets[row]++;
+    }
+
+    double transition(int from, int to) const {
+        if (!sparse) return transition_matrix[static_cast<size_t>(from) * num_states + to];
+        auto first = sparse_transitions.columns.begin() + sparse_transitions.row_offsets[from];
+        auto last = sparse_transitions.columns.begin() + sparse_transitions.row_offsets[from + 1];
+        auto it = std::lower_bound(first, last, to);
+        return it != last && *it == to ? sparse_transitions.values[it - sparse_transitions.columns.begin()] : 0.0;
     }
+    double& emission(int state, int observation) { return emission_matrix[static_cast<size_t>(state) * num_observations + observation]; }
+    double emission(int state, int observation) const { return emission_matrix[static_cast<size_t>(state) * num_observations + observation]; }
 
-    // Initialize transition matrix with random values
+    bool is_sparse() const { return sparse; }
+
+    // Initialize transition, emission and initial probabilities with random values.
+    // Sparse models keep their nonzero pattern and only get new values.
     void initialize_random() {
-        for (auto& row : transition_matrix) {
-            double sum = 0;
-            for (auto& val : row) {
-                val = static_cast<double>(rand()) / RAND_MAX;
-                sum += val;
-            }
-            for (auto& val : row) {
-                val /= sum; // Normalize
+        if (sparse) {
+            for (int row = 0; row < num_states; ++row) {
+                randomize_range(sparse_transitions.values, row_begin(row), row_end(row));
             }
+        } else {
+            randomize_rows(transition_matrix, num_states);
+        }
+        randomize_rows(emission_matrix, num_observations);
+        randomize_rows(state_probabilities, num_states);
+        transitions_changed();
+    }
+
+    // Replace the transitions with a CSR matrix; densified again if it is not actually sparse
+    void set_sparse_transitions(SparseTransitions transitions) {
+        check_sparse(transitions);
+        sparse_transitions = std::move(transitions);
+        transition_matrix.clear();
+        transition_matrix.shrink_to_fit();
+        sparse = true;
+        transitions_changed();
+    }
+
+    // Must be called after editing transition_matrix directly so sampling tables get rebuilt.
+    // Also re-selects the dense or CSR backend from the current density.
+    void transitions_changed() {
+        alias_dirty = true;
+        size_t nonzeros = 0;
+        for (double value : transition_values()) nonzeros += value != 0.0;
+        bool want_sparse = nonzeros < kSparseDensity * num_states * num_states;
+        if (want_sparse && !sparse) {
+            to_sparse();
+        } else if (!want_sparse && sparse) {
+            to_dense();
         }
     }
 
-    // Predict next state based on current state and observations
+    // Predict next state based on current state and observations.
+    // O(1) per call: one draw from the calling thread's generator picks a column of the
+    // current row's alias table and decides between it and its alias. Tables are rebuilt
+    // lazily after the transitions change; call build_alias_tables() first when sampling
+    // from several threads.
     int predict_next_state(int current_state, int observation) {
-        double random_val = static_cast<double>(rand()) / RAND_MAX;
-        double cumulative_prob = 0.0;
-        for (int next_state = 0; next_state < transition_matrix.size(); ++next_state) {
-            cumulative_prob += transition_matrix[current_state][next_state];
-            if (random_val < cumulative_prob) {
-                return next_state;
+        if (alias_dirty) build_alias_tables();
+        return sample_alias(current_state, thread_rng()());
+    }
+
+    // Advance many independent chains in lock-step from initial_states for `steps` steps.
+    // Chains are split into blocks across cores; within a block, random bits for all chains
+    // are generated in one vectorizable pass from a counter-based hash of (seed, chain, step),
+    // so results are identical for any thread count. Occupancy mode keeps one
+    // (steps + 1) x num_states histogram per worker instead of full trajectories.
+    ChainSimulation simulate_chains(const std::vector<uint32_t>& initial_states, size_t steps,
+                                    ChainOutput output, uint64_t seed, int num_threads = 0) {
+        for (uint32_t state : initial_states) {
+            if (state >= static_cast<uint32_t>(num_states)) {
+                throw std::out_of_range("Initial state index out of range.");
+            }
+        }
+        if (alias_dirty) build_alias_tables();
+        const size_t num_chains = initial_states.size();
+        const size_t block = 4096;
+        ChainSimulation result;
+        std::vector<std::vector<uint64_t>> worker_occupancy;
+        if (output == ChainOutput::Trajectories) {
+            result.trajectories.resize((steps + 1) * num_chains);
+        } else {
+            worker_occupancy.assign(effective_threads(num_threads),
+                                    std::vector<uint64_t>((steps + 1) * num_states, 0));
+        }
+
+        parallel_for(num_chains, block, num_threads, [&](size_t begin, size_t end, int worker) {
+            size_t count = end - begin;
+            std::vector<uint32_t> states(initial_states.begin() + begin, initial_states.begin() + end);
+            std::vector<uint64_t> keys(count), bits(count);
+            for (size_t c = 0; c < count; ++c) {
+                keys[c] = counter_hash(seed, begin + c);
+            }
+
+            for (size_t step = 0;; ++step) {
+                if (output == ChainOutput::Trajectories) {
+                    std::copy(states.begin(), states.end(), result.trajectories.begin() + step * num_chains + begin);
+                } else {
+                    uint64_t* histogram = &worker_occupancy[worker][step * num_states];
+                    for (uint32_t state : states) histogram[state]++;
+                }
+                if (step == steps) break;
+
+                for (size_t c = 0; c < count; ++c) {
+                    bits[c] = counter_hash(keys[c], step);
+                }
+                for (size_t c = 0; c < count; ++c) {
+                    states[c] = sample_alias(states[c], bits[c]);
+                }
+            }
+        });
+
+        if (output == ChainOutput::Occupancy) {
+            result.occupancy = std::move(worker_occupancy[0]);
+            for (size_t w = 1; w < worker_occupancy.size(); ++w) {
+                for (size_t k = 0; k < result.occupancy.size(); ++k) {
+                    result.occupancy[k] += worker_occupancy[w][k];
+                }
+            }
+        }
+        return result;
+    }
+
+    // Build Walker/Vose alias tables for every transition row (over its nonzeros when sparse)
+    void build_alias_tables() {
+        alias_table.resize(transition_values().size());
+        std::vector<double> scaled;
+        std::vector<uint32_t> small, large;
+        for (int row = 0; row < num_states; ++row) {
+            size_t begin = row_begin(row);
+            uint32_t length = row_end(row) - begin;
+            const double* values = &transition_values()[begin];
+            AliasEntry* entries = &alias_table[begin];
+            double sum = 0.0;
+            for (uint32_t j = 0; j < length; ++j) sum += values[j];
+            if (sum <= 0.0) {
+                // No outgoing mass: stay in the current state, as the linear scan did
+                std::fill(entries, entries + length, AliasEntry{0, kStayInState});
+                continue;
+            }
+
+            scaled.resize(length);
+            small.clear();
+            large.clear();
+            for (uint32_t j = 0; j < length; ++j) {
+                scaled[j] = values[j] * length / sum;
+                (scaled[j] < 1.0 ? small : large).push_back(j);
+            }
+            while (!small.empty() && !large.empty()) {
+                uint32_t s = small.back(), l = large.back();
+                small.pop_back();
+                entries[s] = AliasEntry{to_threshold(scaled[s]), l};
+                scaled[l] -= 1.0 - scaled[s];
+                if (scaled[l] < 1.0) {
+                    large.pop_back();
+                    small.push_back(l);
+                }
+            }
+            // Leftovers are full columns up to rounding error
+            for (uint32_t j : large) entries[j] = AliasEntry{UINT32_MAX, j};
+            for (uint32_t j : small) entries[j] = AliasEntry{UINT32_MAX, j};
+        }
+        alias_dirty = false;
+    }
+
+    // Scaled forward pass: alpha (T x num_states) holds the normalized forward distribution at each
+    // step and scale[t] the normalizer, so log P(observations) = sum of log(scale[t]) with no underflow
+    std::vector<double> forward(const std::vector<int>& observations, std::vector<double>& scale) const {
+        size_t T = observations.size();
+        std::vector<double> alpha(T * num_states);
+        scale.assign(T, 0.0);
+        for (size_t t = 0; t < T; ++t) {
+            double* current = &alpha[t * num_states];
+            if (t == 0) {
+                std::copy(state_probabilities.begin(), state_probabilities.end(), current);
+            } else {
+                propagate(&alpha[(t - 1) * num_states], current);
+            }
+            scale[t] = apply_emission(current, observations[t]);
+        }
+        return alpha;
+    }
+
+    // Scaled backward pass using the forward scale factors, so alpha[t] * beta[t] is the posterior
+    std::vector<double> backward(const std::vector<int>& observations, const std::vector<double>& scale) const {
+        size_t T = observations.size();
+        std::vector<double> beta(T * num_states);
+        std::vector<double> weighted(num_states);
+        if (T == 0) return beta;
+        std::fill(beta.end() - num_states, beta.end(), 1.0);
+        for (size_t t = T - 1; t > 0; --t) {
+            const double* next = &beta[t * num_states];
+            for (int j = 0; j < num_states; ++j) {
+                weighted[j] = emission(j, observations[t]) * next[j];
+            }
+            double* current = &beta[(t - 1) * num_states];
+            pull_back(weighted.data(), current);
+            for (int i = 0; i < num_states; ++i) {
+                current[i] /= scale[t];
+            }
+        }
+        return beta;
+    }
+
+    // State posteriors (gamma), summed transition posteriors (xi) and log-likelihood of a sequence
+    HMMPosteriors posteriors(const std::vector<int>& observations) const {
+        HMMPosteriors result;
+        std::vector<double> scale;
+        std::vector<double> alpha = forward(observations, scale);
+        std::vector<double> beta = backward(observations, scale);
+        size_t T = observations.size();
+
+        result.gamma.resize(T * num_states);
+        for (size_t k = 0; k < result.gamma.size(); ++k) {
+            result.gamma[k] = alpha[k] * beta[k];
+        }
+
+        // xi_t(i, j) = alpha_t(i) A(i, j) b_j(o_t+1) beta_t+1(j) / scale_t+1, accumulated over t
+        result.xi_sum.assign(transition_values().size(), 0.0);
+        std::vector<double> weighted(num_states);
+        for (size_t t = 0; t + 1 < T; ++t) {
+            const double* a = &alpha[t * num_states];
+            const double* next = &beta[(t + 1) * num_states];
+            for (int j = 0; j < num_states; ++j) {
+                weighted[j] = emission(j, observations[t + 1]) * next[j] / scale[t + 1];
+            }
+            for (int i = 0; i < num_states; ++i) {
+                if (sparse) {
+                    for (size_t k = row_begin(i); k < row_end(i); ++k) {
+                        result.xi_sum[k] += a[i] * sparse_transitions.values[k] * weighted[sparse_transitions.columns[k]];
+                    }
+                    continue;
+                }
+                const double* row = &transition_matrix[static_cast<size_t>(i) * num_states];
+                double* xi_row = &result.xi_sum[static_cast<size_t>(i) * num_states];
+                for (int j = 0; j < num_states; ++j) {
+                    xi_row[j] += a[i] * row[j] * weighted[j];
+                }
+            }
+        }
+
+        for (double c : scale) {
+            result.log_likelihood += std::log(c);
+        }
+        return result;
+    }
+
+    // Fit transition, emission and initial probabilities to a corpus with Baum-Welch (EM).
+    // The E-step is map-reduced: the corpus is split into options.num_blocks contiguous blocks,
+    // each with its own expected-count accumulator, and the blocks are merged in order.
+    // Observations are range-checked before training starts; a sequence with zero probability
+    // under the current parameters throws std::runtime_error from the E-step, leaving the
+    // model with the parameters of the last completed iteration.
+    BaumWelchResult baum_welch(const std::vector<std::vector<int>>& sequences,
+                               const BaumWelchOptions& options = BaumWelchOptions()) {
+        for (const auto& sequence : sequences) {
+            for (int o : sequence) {
+                if (o < 0 || o >= num_observations) {
+                    throw std::out_of_range("Observation index out of range.");
+                }
+            }
+        }
+        BaumWelchResult result;
+        size_t num_blocks = std::max<size_t>(1, std::min<size_t>(options.num_blocks, sequences.size()));
+        size_t block_size = (sequences.size() + num_blocks - 1) / std::max<size_t>(num_blocks, 1);
+        std::vector<ExpectedCounts> blocks(num_blocks);
+
+        for (int iter = 0; iter < options.max_iterations; ++iter) {
+            // E-step: one block per work item, so scheduling cannot change the summation order
+            parallel_for(num_blocks, 1, options.num_threads, [&](size_t begin, size_t end, int) {
+                for (size_t b = begin; b < end; ++b) {
+                    blocks[b].reset(num_states, num_observations, transition_values().size());
+                    size_t last = std::min(sequences.size(), (b + 1) * block_size);
+                    for (size_t s = b * block_size; s < last; ++s) {
+                        accumulate_counts(sequences[s], blocks[b]);
+                    }
+                }
+            });
+
+            ExpectedCounts& total = blocks[0];
+            for (size_t b = 1; b < num_blocks; ++b) {
+                total.merge(blocks[b]);
+            }
+
+            double log_likelihood = total.log_likelihood;
+            bool improved_enough = result.log_likelihoods.empty() ||
+                                   log_likelihood - result.log_likelihoods.back() >= options.tolerance;
+            result.log_likelihoods.push_back(log_likelihood);
+            if (!improved_enough) {
+                result.converged = true;
+                break;
+            }
+
+            // M-step: normalize the expected counts; rows with no mass keep their old values
+            normalize_into(total.initial, state_probabilities, num_states);
+            for (int row = 0; row < num_states; ++row) {
+                normalize_range(total.transitions, transition_values(), row_begin(row), row_end(row));
+            }
+            normalize_into(total.emissions, emission_matrix, num_observations);
+            transitions_changed();
+            result.iterations = iter + 1;
+        }
+        return result;
+    }
+
+    // Most likely state path for one observation sequence
+    std::vector<int> viterbi(const std::vector<int>& observations) const {
+        return viterbi_batch({observations}, 1)[0];
+    }
+
+    // Most likely state paths for a batch of sequences, decoded in parallel across cores.
+    // Log tables are built once per batch and every worker reuses its scratch buffers, so
+    // per-sequence overhead is only the path allocation.
+    std::vector<std::vector<int>> viterbi_batch(const std::vector<std::vector<int>>& sequences,
+                                                int num_threads = 0) const {
+        if (num_states <= 256) return viterbi_batch_impl<uint8_t>(sequences, num_threads);
+        if (num_states <= 65536) return viterbi_batch_impl<uint16_t>(sequences, num_threads);
+        return viterbi_batch_impl<uint32_t>(sequences, num_threads);
+    }
+
+private:
+    // Fill each row of a row-major matrix with random values normalized to sum to one
+    static void randomize_rows(std::vector<double>& matrix, int row_length) {
+        for (size_t start = 0; start < matrix.size(); start += row_length) {
+            randomize_range(matrix, start, start + row_length);
+        }
+    }
+
+    static void randomize_range(std::vector<double>& values, size_t begin, size_t end) {
+        double sum = 0;
+        for (size_t k = begin; k < end; ++k) {
+            values[k] = static_cast<double>(rand()) / RAND_MAX;
+            sum += values[k];
+        }
+        for (size_t k = begin; k < end; ++k) {
+            values[k] /= sum; // Normalize
+        }
+    }
+
+    bool sparse = false;
+
+    // Transition values in storage order: the dense matrix, or the CSR values when sparse
+    std::vector<double>& transition_values() { return sparse ? sparse_transitions.values : transition_matrix; }
+    const std::vector<double>& transition_values() const { return sparse ? sparse_transitions.values : transition_matrix; }
+
+    // Range of a row within transition_values() and the column of an entry in it
+    size_t row_begin(int row) const { return sparse ? sparse_transitions.row_offsets[row] : static_cast<size_t>(row) * num_states; }
+    size_t row_end(int row) const { return row_begin(row + 1); }
+    int column_at(int row, size_t k) const { return sparse ? sparse_transitions.columns[k] : static_cast<int>(k - row_begin(row)); }
+
+    // Row offsets must start at 0 and never decrease; columns must be in [0, num_states) and
+    // strictly increasing within each row (lookups binary-search them)
+    void check_sparse(const SparseTransitions& csr) const {
+        if (csr.row_offsets.size() != static_cast<size_t>(num_states) + 1 || csr.row_offsets.front() != 0 ||
+            csr.columns.size() != csr.values.size() || csr.row_offsets.back() != csr.values.size()) {
+            throw std::invalid_argument("Sparse transition matrix does not match the model size.");
+        }
+        for (int row = 0; row < num_states; ++row) {
+            size_t begin = csr.row_offsets[row], end = csr.row_offsets[row + 1];
+            if (begin > end) {
+                throw std::invalid_argument("Sparse transition row offsets must be non-decreasing.");
+            }
+            for (size_t k = begin; k < end; ++k) {
+                if (csr.columns[k] < 0 || csr.columns[k] >= num_states) {
+                    throw std::invalid_argument("Sparse transition column out of range.");
+                }
+                if (k > begin && csr.columns[k] <= csr.columns[k - 1]) {
+                    throw std::invalid_argument("Sparse transition columns must be strictly increasing in each row.");
+                }
+            }
+        }
+    }
+
+    void to_sparse() {
+        SparseTransitions csr;
+        csr.row_offsets.reserve(num_states + 1);
+        csr.row_offsets.push_back(0);
+        for (int i = 0; i < num_states; ++i) {
+            for (int j = 0; j < num_states; ++j) {
+                double value = transition_matrix[static_cast<size_t>(i) * num_states + j];
+                if (value != 0.0) {
+                    csr.columns.push_back(j);
+                    csr.values.push_back(value);
+                }
+            }
+            csr.row_offsets.push_back(csr.values.size());
+        }
+        sparse_transitions = std::move(csr);
+        transition_matrix.clear();
+        transition_matrix.shrink_to_fit();
+        sparse = true;
+    }
+
+    void to_dense() {
+        transition_matrix.assign(static_cast<size_t>(num_states) * num_states, 0.0);
+        for (int i = 0; i < num_states; ++i) {
+            for (size_t k = row_begin(i); k < row_end(i); ++k) {
+                transition_matrix[static_cast<size_t>(i) * num_states + sparse_transitions.columns[k]] =
+                    sparse_transitions.values[k];
+            }
+        }
+        sparse_transitions = SparseTransitions();
+        sparse = false;
+    }
+
+    // next = previous^T * A: accumulates whole transition rows so the inner loop is contiguous
+    void propagate(const double* previous, double* next) const {
+        std::fill(next, next + num_states, 0.0);
+        if (sparse) {
+            for (int i = 0; i < num_states; ++i) {
+                double weight = previous[i];
+                for (size_t k = row_begin(i); k < row_end(i); ++k) {
+                    next[sparse_transitions.columns[k]] += weight * sparse_transitions.values[k];
+                }
+            }
+            return;
+        }
+        for (int i = 0; i < num_states; ++i) {
+            const double* row = &transition_matrix[static_cast<size_t>(i) * num_states];
+            double weight = previous[i];
+            for (int j = 0; j < num_states; ++j) {
+                next[j] += weight * row[j];
+            }
+        }
+    }
+
+    // previous = A * weighted: one row-major matrix-vector product (the backward step)
+    void pull_back(const double* weighted, double* previous) const {
+        for (int i = 0; i < num_states; ++i) {
+            double sum = 0.0;
+            if (sparse) {
+                for (size_t k = row_begin(i); k < row_end(i); ++k) {
+                    sum += sparse_transitions.values[k] * weighted[sparse_transitions.columns[k]];
+                }
+            } else {
+                const double* row = &transition_matrix[static_cast<size_t>(i) * num_states];
+                for (int j = 0; j < num_states; ++j) {
+                    sum += row[j] * weighted[j];
+                }
+            }
+            previous[i] = sum;
+        }
+    }
+
+    // Multiply in the emission probabilities of an observation and normalize; returns the normalizer
+    double apply_emission(double* distribution, int observation) const {
+        if (observation < 0 || observation >= num_observations) {
+            throw std::out_of_range("Observation index out of range.");
+        }
+        double sum = 0.0;
+        for (int i = 0; i < num_states; ++i) {
+            distribution[i] *= emission(i, observation);
+            sum += distribution[i];
+        }
+        if (sum <= 0.0) {
+            throw std::runtime_error("Observation sequence has zero probability under the model.");
+        }
+        for (int i = 0; i < num_states; ++i) {
+            distribution[i] /= sum;
+        }
+        return sum;
+    }
+
+    // Alias table entry: entry j of a row is kept when the low 32 random bits fall below
+    // threshold, otherwise the draw goes to entry alias of the same row
+    struct AliasEntry {
+        uint32_t threshold;
+        uint32_t alias;
+    };
+
+    static constexpr uint32_t kStayInState = UINT32_MAX; // Alias marker for rows with no mass
+
+    std::vector<AliasEntry> alias_table; // Parallel to transition_values()
+    bool alias_dirty = true;
+
+    static uint32_t to_threshold(double probability) {
+        return probability >= 1.0 ? UINT32_MAX : static_cast<uint32_t>(probability * 4294967296.0);
+    }
+
+    // High 32 bits choose the entry (multiply-shift, no modulo), low 32 bits the coin flip
+    int sample_alias(int row, uint64_t bits) const {
+        size_t begin = row_begin(row);
+        uint64_t length = row_end(row) - begin;
+        if (length == 0) return row;
+        uint32_t pick = static_cast<uint32_t>(((bits >> 32) * length) >> 32);
+        const AliasEntry& entry = alias_table[begin + pick];
+        pick = static_cast<uint32_t>(bits) < entry.threshold ? pick : entry.alias;
+        return pick == kStayInState ? row : column_at(row, begin + pick);
+    }
+
+    // Expected sufficient statistics gathered by the Baum-Welch E-step
+    struct ExpectedCounts {
+        std::vector<double> initial;
+        std::vector<double> transitions;
+        std::vector<double> emissions;
+        double log_likelihood = 0.0;
+
+        void reset(int states, int observations, size_t transition_entries) {
+            initial.assign(states, 0.0);
+            transitions.assign(transition_entries, 0.0);
+            emissions.assign(static_cast<size_t>(states) * observations, 0.0);
+            log_likelihood = 0.0;
+        }
+
+        void merge(const ExpectedCounts& other) {
+            for (size_t k = 0; k < initial.size(); ++k) initial[k] += other.initial[k];
+            for (size_t k = 0; k < transitions.size(); ++k) transitions[k] += other.transitions[k];
+            for (size_t k = 0; k < emissions.size(); ++k) emissions[k] += other.emissions[k];
+            log_likelihood += other.log_likelihood;
+        }
+    };
+
+    void accumulate_counts(const std::vector<int>& observations, ExpectedCounts& counts) const {
+        if (observations.empty()) return;
+        HMMPosteriors post = posteriors(observations);
+        for (int i = 0; i < num_states; ++i) {
+            counts.initial[i] += post.gamma[i];
+        }
+        for (size_t k = 0; k < post.xi_sum.size(); ++k) {
+            counts.transitions[k] += post.xi_sum[k];
+        }
+        for (size_t t = 0; t < observations.size(); ++t) {
+            const double* gamma = &post.gamma[t * num_states];
+            for (int i = 0; i < num_states; ++i) {
+                counts.emissions[static_cast<size_t>(i) * num_observations + observations[t]] += gamma[i];
+            }
+        }
+        counts.log_likelihood += post.log_likelihood;
+    }
+
+    // Copy each row of counts into target normalized to sum to one, skipping empty rows
+    static void normalize_into(const std::vector<double>& counts, std::vector<double>& target, int row_length) {
+        for (size_t start = 0; start < counts.size(); start += row_length) {
+            normalize_range(counts, target, start, start + row_length);
+        }
+    }
+
+    static void normalize_range(const std::vector<double>& counts, std::vector<double>& target, size_t begin, size_t end) {
+        double sum = 0.0;
+        for (size_t k = begin; k < end; ++k) sum += counts[k];
+        if (sum <= 0.0) return;
+        for (size_t k = begin; k < end; ++k) target[k] = counts[k] / sum;
+    }
+
+    // Log-space tables for Viterbi; emissions are stored observation-major so each step reads one row
+    struct ViterbiTables {
+        std::vector<double> log_transition;
+        std::vector<double> log_emission;
+        std::vector<double> log_initial;
+    };
+
+    // Per-worker buffers; backpointers use the narrowest index type that fits num_states
+    template <typename Index>
+    struct ViterbiScratch {
+        std::vector<double> delta;
+        std::vector<double> next;
+        std::vector<Index> backpointers;
+    };
+
+    ViterbiTables viterbi_tables() const {
+        ViterbiTables tables;
+        const std::vector<double>& values = transition_values();
+        tables.log_transition.resize(values.size());
+        for (size_t k = 0; k < values.size(); ++k) {
+            tables.log_transition[k] = std::log(values[k]);
+        }
+        tables.log_emission.resize(emission_matrix.size());
+        for (int i = 0; i < num_states; ++i) {
+            for (int o = 0; o < num_observations; ++o) {
+                tables.log_emission[static_cast<size_t>(o) * num_states + i] = std::log(emission(i, o));
+            }
+        }
+        tables.log_initial.resize(num_states);
+        for (int i = 0; i < num_states; ++i) {
+            tables.log_initial[i] = std::log(state_probabilities[i]);
+        }
+        return tables;
+    }
+
+    template <typename Index>
+    std::vector<std::vector<int>> viterbi_batch_impl(const std::vector<std::vector<int>>& sequences,
+                                                     int num_threads) const {
+        ViterbiTables tables = viterbi_tables();
+        std::vector<std::vector<int>> paths(sequences.size());
+        std::vector<ViterbiScratch<Index>> scratch(effective_threads(num_threads));
+        parallel_for(sequences.size(), 64, num_threads, [&](size_t begin, size_t end, int worker) {
+            for (size_t s = begin; s < end; ++s) {
+                paths[s] = viterbi_decode(tables, sequences[s], scratch[worker]);
             }
+        });
+        return paths;
+    }
+
+    template <typename Index>
+    std::vector<int> viterbi_decode(const ViterbiTables& tables, const std::vector<int>& observations,
+                                    ViterbiScratch<Index>& scratch) const {
+        size_t T = observations.size();
+        std::vector<int> path(T);
+        if (T == 0) return path;
+        for (int o : observations) {
+            if (o < 0 || o >= num_observations) {
+                throw std::out_of_range("Observation index out of range.");
+            }
+        }
+
+        const int N = num_states;
+        scratch.delta.resize(N);
+        scratch.next.resize(N);
+        scratch.backpointers.resize(T * N);
+        double* delta = scratch.delta.data();
+        double* next = scratch.next.data();
+
+        const double* log_b = &tables.log_emission[static_cast<size_t>(observations[0]) * N];
+        for (int j = 0; j < N; ++j) {
+            delta[j] = tables.log_initial[j] + log_b[j];
+        }
+
+        for (size_t t = 1; t < T; ++t) {
+            Index* bp = &scratch.backpointers[t * N];
+            std::fill(next, next + N, -std::numeric_limits<double>::infinity());
+            std::fill(bp, bp + N, Index(0));
+            if (sparse) {
+                // Max-plus step scattered over each row's nonzeros
+                for (int i = 0; i < N; ++i) {
+                    const double d = delta[i];
+                    for (size_t k = row_begin(i); k < row_end(i); ++k) {
+                        int j = sparse_transitions.columns[k];
+                        double candidate = d + tables.log_transition[k];
+                        if (candidate > next[j]) {
+                            next[j] = candidate;
+                            bp[j] = static_cast<Index>(i);
+                        }
+                    }
+                }
+            } else {
+                // Max-plus vector-matrix step over whole transition rows; the branch-free
+                // select keeps the inner loop vectorizable
+                for (int i = 0; i < N; ++i) {
+                    const double* row = &tables.log_transition[static_cast<size_t>(i) * N];
+                    const double d = delta[i];
+                    const Index from = static_cast<Index>(i);
+                    for (int j = 0; j < N; ++j) {
+                        double candidate = d + row[j];
+                        bool better = candidate > next[j];
+                        next[j] = better ? candidate : next[j];
+                        bp[j] = better ? from : bp[j];
+                    }
+                }
+            }
+            log_b = &tables.log_emission[static_cast<size_t>(observations[t]) * N];
+            for (int j = 0; j < N; ++j) {
+                next[j] += log_b[j];
+            }
+            std::swap(delta, next);
+        }
+
+        path[T - 1] = static_cast<int>(std::max_element(delta, delta + N) - delta);
+        for (size_t t = T - 1; t > 0; --t) {
+            path[t - 1] = scratch.backpointers[t * N + path[t]];
+        }
+        return path;
+    }
+};
+
+// Online filter for a live observation stream: keeps only the normalized forward distribution
+// (and, for fixed-lag smoothing, the last `lag` distributions and observations), so memory is
+// constant and each update costs one forward step, O(nnz) of the transition matrix.
+class OnlineHMMFilter {
+public:
+    OnlineHMMFilter(const HiddenMarkovModel& model, int lag = 0)
+        : model(model), lag(std::max(lag, 0)) {
+        int n = model.num_states;
+        current.resize(n);
+        scratch.resize(n);
+        beta.resize(n);
+        history.resize(static_cast<size_t>(this->lag + 1) * n);
+        observations.resize(this->lag + 1);
+        reset();
+    }
+
+    // Start a new stream from the model's initial distribution
+    void reset() {
+        step_count = 0;
+        total_log_likelihood = 0.0;
+    }
+
+    // Fold in one observation and return the filtered distribution P(state_t | o_1..o_t).
+    // The step is computed in scratch, so a rejected observation leaves the filter unchanged.
+    const std::vector<double>& update(int observation) {
+        if (step_count == 0) {
+            std::copy(model.state_probabilities.begin(), model.state_probabilities.end(), scratch.begin());
+        } else {
+            model.propagate(current.data(), scratch.data());
+        }
+        double normalizer = model.apply_emission(scratch.data(), observation);
+        std::swap(current, scratch);
+        total_log_likelihood += std::log(normalizer);
+
+        size_t slot = step_count % (lag + 1);
+        std::copy(current.begin(), current.end(), history.begin() + slot * model.num_states);
+        observations[slot] = observation;
+        ++step_count;
+        return current;
+    }
+
+    const std::vector<double>& belief() const { return current; }
+    double log_likelihood() const { return total_log_likelihood; }
+    size_t steps() const { return step_count; }
+
+    // Fixed-lag smoothed distribution P(state_t-lag | o_1..o_t), or of the oldest step kept
+    // while fewer than lag + 1 observations have arrived; costs `lag` backward steps
+    void smoothed(std::vector<double>& out) {
+        int n = model.num_states;
+        out.resize(n);
+        if (step_count == 0) {
+            std::copy(model.state_probabilities.begin(), model.state_probabilities.end(), out.begin());
+            return;
+        }
+        size_t window = std::min<size_t>(lag, step_count - 1);
+        size_t oldest = step_count - 1 - window;
+
+        std::fill(beta.begin(), beta.end(), 1.0);
+        for (size_t t = step_count - 1; t > oldest; --t) {
+            int observation = observations[t % (lag + 1)];
+            for (int j = 0; j < n; ++j) {
+                scratch[j] = model.emission(j, observation) * beta[j];
+            }
+            model.pull_back(scratch.data(), beta.data());
+            normalize(beta);
+        }
+
+        const double* filtered = &history[(oldest % (lag + 1)) * n];
+        for (int i = 0; i < n; ++i) {
+            out[i] = filtered[i] * beta[i];
         }
-        return current_state; // If no change
+        normalize(out);
     }
+
+private:
+    static void normalize(std::vector<double>& values) {
+        double sum = std::accumulate(values.begin(), values.end(), 0.0);
+        if (sum <= 0.0) return;
+        for (double& value : values) value /= sum;
+    }
+
+    const HiddenMarkovModel& model;
+    size_t lag;
+    std::vector<double> current;    // Normalized forward distribution at the latest step
+    std::vector<double> scratch;
+    std::vector<double> beta;
+    std::vector<double> history;    // Ring buffer of the last lag + 1 filtered distributions
+    std::vector<int> observations;  // Ring buffer of the matching observations
+    size_t step_count = 0;
+    double total_log_likelihood = 0.0;
 };
 
 // Chakra Class to model energy states and quantum vectors
@@ -85,12 +990,76 @@ std::vector<double> cross_product(const std::vector<double>& v1, const std::vect
     };
 }
 
+// Poisson sample by multiplying uniforms until the product drops below e^-lambda; O(lambda),
+// so only used for small lambda
+int poisson_inversion(double lambda, FastRng& rng) {
+    double limit = std::exp(-lambda);
+    double product = rng.uniform();
+    int count = 0;
+    while (product > limit) {
+        ++count;
+        product *= rng.uniform();
+    }
+    return count;
+}
+
+// Poisson sample by transformed rejection with squeeze (Hormann's PTRS); O(1) expected for lambda >= 10.
+// A NaN or infinite lambda would never pass the acceptance test, so it is rejected up front.
+int poisson_ptrs(double lambda, FastRng& rng) {
+    if (!std::isfinite(lambda) || lambda < 0.0) {
+        throw std::invalid_argument("Poisson rate must be finite and non-negative.");
+    }
+    double slam = std::sqrt(lambda);
+    double loglam = std::log(lambda);
+    double b = 0.931 + 2.53 * slam;
+    double a = -0.059 + 0.02483 * b;
+    double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+    double vr = 0.9277 - 3.6224 / (b - 2);
+    while (true) {
+        double u = rng.uniform() - 0.5;
+        double v = rng.uniform();
+        double us = 0.5 - std::fabs(u);
+        double k = std::floor((2 * a / us + b) * u + lambda + 0.43);
+        if (us >= 0.07 && v <= vr) {
+            return static_cast<int>(k);
+        }
+        if (k < 0 || (us < 0.013 && v > us)) {
+            continue;
+        }
+        if (std::log(v) + std::log(invalpha) - std::log(a / (us * us) + b) <=
+            -lambda + k * loglam - std::lgamma(k + 1)) {
+            return static_cast<int>(k);
+        }
+    }
+}
+
+// Fill jumps[i] with Poisson(lambdas[i]) samples from the calling thread's persistent generator,
+// choosing inversion or PTRS per lambda. Every lambda must be finite and non-negative
+// (invalid_argument otherwise); they are all checked before any sample is drawn.
+void poisson_jumps(const double* lambdas, int* jumps, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!std::isfinite(lambdas[i]) || lambdas[i] < 0.0) {
+            throw std::invalid_argument("Poisson rate must be finite and non-negative.");
+        }
+    }
+    FastRng& rng = thread_rng();
+    for (size_t i = 0; i < count; ++i) {
+        double lambda = lambdas[i];
+        jumps[i] = lambda <= 0.0 ? 0 : lambda < 10.0 ? poisson_inversion(lambda, rng) : poisson_ptrs(lambda, rng);
+    }
+}
+
+std::vector<int> poisson_jumps(const std::vector<double>& lambdas) {
+    std::vector<int> jumps(lambdas.size());
+    poisson_jumps(lambdas.data(), jumps.data(), lambdas.size());
+    return jumps;
+}
+
 // Poisson Distribution to simulate chakra energy jumps
 int poisson_jump(double lambda) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::poisson_distribution<> d(lambda);
-    return d(gen);
+    int jump;
+    poisson_jumps(&lambda, &jump, 1);
+    return jump;
 }
 
 // Utility function to create chakra units in quantum space
@@ -113,6 +1082,44 @@ int main() {
         chakras.push_back(create_chakra(3, 100.0 + i * 10)); // Energy levels increase for each chakra
     }
 
+    // Posterior inference over a long observation sequence (scaled, so it does not underflow)
+    std::vector<int> observations(100000);
+    for (auto& o : observations) o = rand() % 3;
+    HMMPosteriors posteriors = hmm.posteriors(observations);
+    std::cout << "Log-likelihood of " << observations.size() << " observations: " << posteriors.log_likelihood << std::endl;
+    std::cout << "Final state posterior: ";
+    for (int i = 0; i < hmm.num_states; ++i) {
+        std::cout << std::fixed << std::setprecision(2) << posteriors.gamma[(observations.size() - 1) * hmm.num_states + i] << " ";
+    }
+    std::cout << std::endl;
+
+    // Decode a batch of short sequences in parallel
+    std::vector<std::vector<int>> batch(1000, std::vector<int>(20));
+    for (auto& sequence : batch) {
+        for (auto& o : sequence) o = rand() % 3;
+    }
+    std::vector<std::vector<int>> paths = hmm.viterbi_batch(batch);
+    std::cout << "Viterbi path of first sequence: ";
+    for (int state : paths[0]) std::cout << state << " ";
+    std::cout << std::endl;
+
+    // Refit the model to the sampled corpus with Baum-Welch
+    BaumWelchResult training = hmm.baum_welch(batch);
+    std::cout << "Baum-Welch: " << training.iterations << " iterations, log-likelihood "
+              << training.log_likelihoods.front() << " -> " << training.log_likelihoods.back() << std::endl;
+
+    // Online filter tracking the belief over hidden states as observations stream in
+    OnlineHMMFilter filter(hmm, 3);
+    std::vector<double> smoothed;
+
+    // Monte Carlo forecast: occupancy of 100000 chains over 10 steps, all starting in state 0
+    ChainSimulation simulation = hmm.simulate_chains(std::vector<uint32_t>(100000, 0), 10, ChainOutput::Occupancy, 7);
+    std::cout << "State occupancy after 10 steps: ";
+    for (int i = 0; i < hmm.num_states; ++i) {
+        std::cout << simulation.occupancy[10 * hmm.num_states + i] << " ";
+    }
+    std::cout << std::endl;
+
     // Run the system continuously
     while (true) {
         std::cout << "=== New Iteration ===\n";
@@ -138,11 +1145,20 @@ int main() {
 
         // Simulate Poisson energy jumps for each chakra
         double lambda = 5.0;  // Poisson parameter for energy jumps
+        std::vector<int> chakra_jumps = poisson_jumps(std::vector<double>(7, lambda));
         for (int i = 0; i < 7; ++i) {
-            int chakra_jump = poisson_jump(lambda);
-            std::cout << "Poisson Jump for Chakra " << i + 1 << ": " << chakra_jump << std::endl;
+            std::cout << "Poisson Jump for Chakra " << i + 1 << ": " << chakra_jumps[i] << std::endl;
         }
 
+        // Feed this iteration's first energy jump to the filter as the observed symbol
+        filter.update(chakra_jumps[0] % hmm.num_observations);
+        filter.smoothed(smoothed);
+        std::cout << "Filtered belief: ";
+        for (double p : filter.belief()) std::cout << std::fixed << std::setprecision(2) << p << " ";
+        std::cout << "| Smoothed (lag 3): ";
+        for (double p : smoothed) std::cout << std::fixed << std::setprecision(2) << p << " ";
+        std::cout << std::endl;
+
         // Predict next state for each chakra using HMM
         for (int i = 0; i < 7; ++i) {
             int next_state = hmm.predict_next_state(i % 3, 1); // Arbitrary observation index
@@ -14,7 +14,20 @@ public:
     HilbertVector(initializer_list<complex<double>> list) : components(list) {}
 
     // Apply a gate (2x2 matrix) to this vector
+    // Diagonal gates (phase, Z) only scale the components and permutation gates (X) only
+    // exchange them, so those skip the dense product
     HilbertVector applyGate(const vector<vector<complex<double>>>& gate) const {
+        const complex<double> zero(0.0, 0.0), one(1.0, 0.0);
+        if (gate[0][1] == zero && gate[1][0] == zero) {
+            return HilbertVector({gate[0][0] * components[0], gate[1][1] * components[1]});
+        }
+        if (gate[0][0] == zero && gate[1][1] == zero) {
+            if (gate[0][1] == one && gate[1][0] == one) {
+                return HilbertVector({components[1], components[0]});
+            }
+            return HilbertVector({gate[0][1] * components[1], gate[1][0] * components[0]});
+        }
+
         vector<complex<double>> new_components(2);
         new_components[0] = gate[0][0] * components[0] + gate[0][1] * components[1];
         new_components[1] = gate[1][0] * components[0] + gate[1][1] * components[1];
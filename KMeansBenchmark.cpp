@@ -0,0 +1,197 @@
+// Benchmark for the k-means engines in KMeansClusterFormationSpecialized.cpp.
+// Build: g++ -std=c++17 -O2 -pthread KMeansBenchmark.cpp -o kmeans_bench
+// Usage: kmeans_bench [--n 1000,100000] [--k 2,64] [--d 3,128] [--modes naive,restarts,mapped]
+//                     [--n-init 4] [--max-iters 20] [--seed 42] [--format csv|json]
+#define KMEANS_NO_MAIN
+#include "KMeansClusterFormationSpecialized.cpp"
+
+#include <chrono>
+#include <functional>
+#include <sstream>
+
+// Measurements of one engine on one data set
+struct BenchmarkResult {
+    double seconds = 0.0;
+    int iterations = 0;
+    uint64_t distance_evaluations = 0;
+    double inertia = 0.0;
+};
+
+struct BenchmarkConfig {
+    vector<size_t> n_values = {1000, 10000, 100000};
+    vector<int> k_values = {2, 16, 64};
+    vector<int> d_values = {3, 32, 128};
+    vector<string> modes = {"naive", "restarts", "mapped"};
+    int n_init = 4;
+    int max_iters = 20;
+    uint64_t seed = 42;
+    string format = "csv";
+};
+
+// Gaussian blobs around k random centres, reproducible from the seed
+Cluster make_blobs(size_t n, int k, int dim, uint64_t seed) {
+    mt19937_64 gen(seed);
+    normal_distribution<double> centre_dist(0.0, 10.0);
+    normal_distribution<double> noise(0.0, 1.0);
+
+    Cluster centres(k, Point(dim));
+    for (auto& centre : centres) {
+        for (double& value : centre) value = centre_dist(gen);
+    }
+
+    Cluster data(n, Point(dim));
+    for (size_t i = 0; i < n; ++i) {
+        const Point& centre = centres[i % k];
+        for (int d = 0; d < dim; ++d) {
+            data[i][d] = centre[d] + noise(gen);
+        }
+    }
+    return data;
+}
+
+// An engine under test; every k-means mode registers one entry in benchmark_modes()
+struct BenchmarkMode {
+    string name;
+    function<BenchmarkResult(const Cluster&, int, const BenchmarkConfig&)> run;
+};
+
+template <typename F>
+double time_seconds(F&& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+vector<BenchmarkMode> benchmark_modes() {
+    return {
+        // Single in-memory run: one assignment pass per iteration plus the final scoring pass
+        {"naive", [](const Cluster& data, int k, const BenchmarkConfig& config) {
+            BenchmarkResult r;
+            KMeansResult km;
+            r.seconds = time_seconds([&] { km = kmeans_cosine_single(data, k, config.max_iters, config.seed); });
+            r.iterations = km.iterations;
+            r.distance_evaluations = km.distance_evaluations;
+            r.inertia = km.inertia;
+            return r;
+        }},
+        // n_init concurrent restarts; iterations are the winner's, distance evaluations cover all restarts
+        {"restarts", [](const Cluster& data, int k, const BenchmarkConfig& config) {
+            BenchmarkResult r;
+            KMeansResult km;
+            r.seconds = time_seconds(
+                [&] { km = kmeans_cosine_restarts(data, k, config.max_iters, config.n_init, config.seed); });
+            r.iterations = km.iterations;
+            r.distance_evaluations = km.distance_evaluations;
+            r.inertia = km.inertia;
+            return r;
+        }},
+        // Out-of-core engine over a float point file; file writing is not timed
+        {"mapped", [](const Cluster& data, int k, const BenchmarkConfig& config) {
+            BenchmarkResult r;
+            string path = "kmeans_bench_points.bin";
+            write_point_file(path, data, true);
+            {
+                MappedPointFile file(path);
+                KMeansResult km;
+                r.seconds = time_seconds([&] { km = kmeans_cosine_mapped(file, k, config.max_iters, config.seed); });
+                r.iterations = km.iterations;
+                r.distance_evaluations = km.distance_evaluations;
+                r.inertia = km.inertia;
+            }
+            remove(path.c_str());
+            return r;
+        }},
+    };
+}
+
+template <typename T>
+vector<T> parse_list(const string& text) {
+    vector<T> values;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ',')) {
+        stringstream item_stream(item);
+        T value;
+        item_stream >> value;
+        values.push_back(value);
+    }
+    return values;
+}
+
+// Every option takes a value; a missing value or unknown option throws invalid_argument
+BenchmarkConfig parse_args(int argc, char* argv[]) {
+    BenchmarkConfig config;
+    for (int i = 1; i < argc; i += 2) {
+        string flag = argv[i];
+        if (i + 1 >= argc) throw invalid_argument("Missing value for option: " + flag);
+        string value = argv[i + 1];
+        if (flag == "--n") config.n_values = parse_list<size_t>(value);
+        else if (flag == "--k") config.k_values = parse_list<int>(value);
+        else if (flag == "--d") config.d_values = parse_list<int>(value);
+        else if (flag == "--modes") config.modes = parse_list<string>(value);
+        else if (flag == "--n-init") config.n_init = stoi(value);
+        else if (flag == "--max-iters") config.max_iters = stoi(value);
+        else if (flag == "--seed") config.seed = stoull(value);
+        else if (flag == "--format") config.format = value;
+        else throw invalid_argument("Unknown option: " + flag);
+    }
+    return config;
+}
+
+// JSON has no inf or nan (e.g. the inertia of a run that never scored), so write null
+string json_number(double value) {
+    if (!isfinite(value)) return "null";
+    ostringstream out;
+    out << value;
+    return out.str();
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkConfig config;
+    try {
+        config = parse_args(argc, argv);
+    } catch (const exception& e) {
+        cerr << e.what() << endl
+             << "Usage: " << argv[0] << " [--n 1000,100000] [--k 2,64] [--d 3,128] [--modes naive,restarts,mapped]"
+             << " [--n-init 4] [--max-iters 20] [--seed 42] [--format csv|json]" << endl;
+        return 1;
+    }
+    vector<BenchmarkMode> modes = benchmark_modes();
+    bool json = config.format == "json";
+
+    if (json) {
+        cout << "[" << endl;
+    } else {
+        cout << "mode,n,k,d,seconds,iterations,distance_evaluations,inertia" << endl;
+    }
+
+    bool first = true;
+    for (size_t n : config.n_values) {
+        for (int d : config.d_values) {
+            for (int k : config.k_values) {
+                if (static_cast<size_t>(k) > n) continue;
+                Cluster data = make_blobs(n, k, d, config.seed);
+                for (const auto& mode : modes) {
+                    if (find(config.modes.begin(), config.modes.end(), mode.name) == config.modes.end()) continue;
+                    BenchmarkResult r = mode.run(data, k, config);
+                    if (json) {
+                        cout << (first ? "" : ",\n") << "  {\"mode\": \"" << mode.name << "\", \"n\": " << n
+                             << ", \"k\": " << k << ", \"d\": " << d << ", \"seconds\": " << json_number(r.seconds)
+                             << ", \"iterations\": " << r.iterations
+                             << ", \"distance_evaluations\": " << r.distance_evaluations
+                             << ", \"inertia\": " << json_number(r.inertia) << "}";
+                    } else {
+                        cout << mode.name << "," << n << "," << k << "," << d << "," << r.seconds << ","
+                             << r.iterations << "," << r.distance_evaluations << "," << r.inertia << endl;
+                    }
+                    first = false;
+                }
+            }
+        }
+    }
+
+    if (json) {
+        cout << "\n]" << endl;
+    }
+    return 0;
+}
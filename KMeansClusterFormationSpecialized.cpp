@@ -4,6 +4,18 @@
 #include <limits>
 #include <random>
 #include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "KMeansRestarts.h"
 
 using namespace std;
 
@@ -64,38 +76,301 @@ Cluster update_centroids(const Cluster& data, const vector<int>& assignments, in
     return new_centroids;
 }
 
-// K-means clustering with cosine similarity
-Cluster kmeans_cosine(const Cluster& data, int k, int max_iters = 100) {
+// Result of a k-means run: final centroids, assignments and their inertia
+struct KMeansResult {
+    Cluster centroids;
+    vector<int> assignments;
+    double inertia = numeric_limits<double>::infinity();
+    int iterations = 0;
+    bool converged = false;
+    uint64_t distance_evaluations = 0; // Point-centroid similarities computed (all restarts)
+};
+
+// Inertia for cosine k-means: sum of cosine distances (1 - similarity) to the assigned centroid
+double cosine_inertia(const Cluster& data, const Cluster& centroids, const vector<int>& assignments) {
+    double inertia = 0.0;
+    for (size_t i = 0; i < data.size(); ++i) {
+        inertia += 1.0 - cosine_similarity(data[i], centroids[assignments[i]]);
+    }
+    return inertia;
+}
+
+// Single k-means run with cosine similarity, initialised from the given seed
+KMeansResult kmeans_cosine_single(const Cluster& data, int k, int max_iters, uint64_t seed) {
     int n = data.size();
     int dim = data[0].size();
-    Cluster centroids(k);
+    KMeansResult result;
+    result.centroids.resize(k);
 
     // Randomly initialize centroids
-    random_device rd;
-    mt19937 gen(rd());
+    mt19937_64 gen(seed);
     uniform_int_distribution<> dist(0, n - 1);
     for (int i = 0; i < k; ++i) {
-        centroids[i] = data[dist(gen)];
+        result.centroids[i] = data[dist(gen)];
     }
 
-    vector<int> assignments(n);
-
     for (int iter = 0; iter < max_iters; ++iter) {
         // Step 1: Assign points to the nearest centroid based on cosine similarity
-        assignments = assign_clusters(data, centroids);
+        result.assignments = assign_clusters(data, result.centroids);
+        result.iterations = iter + 1;
 
         // Step 2: Update centroids based on current assignments
-        Cluster new_centroids = update_centroids(data, assignments, k, dim);
+        Cluster new_centroids = update_centroids(data, result.assignments, k, dim);
 
         // Check for convergence (if centroids do not change)
-        if (new_centroids == centroids) {
-            cout << "Converged in " << iter + 1 << " iterations." << endl;
+        if (new_centroids == result.centroids) {
+            result.converged = true;
+            break;
+        }
+        result.centroids = new_centroids;
+    }
+
+    result.assignments = assign_clusters(data, result.centroids);
+    result.inertia = cosine_inertia(data, result.centroids, result.assignments);
+    result.distance_evaluations = uint64_t(result.iterations + 1) * n * k;
+    return result;
+}
+
+// Run n_init independent restarts concurrently and keep the lowest-inertia solution.
+// Seeds come from run_restarts (restart 0 is kmeans_cosine_single with `seed`), so the result
+// is reproducible regardless of how many threads run the restarts; ties go to the lowest index.
+KMeansResult kmeans_cosine_restarts(const Cluster& data, int k, int max_iters, int n_init, uint64_t seed) {
+    vector<KMeansResult> results = run_restarts<KMeansResult>(
+        n_init, seed, [&](uint64_t restart_seed) { return kmeans_cosine_single(data, k, max_iters, restart_seed); });
+
+    size_t best = 0;
+    uint64_t distance_evaluations = results[0].distance_evaluations;
+    for (size_t r = 1; r < results.size(); ++r) {
+        distance_evaluations += results[r].distance_evaluations;
+        if (results[r].inertia < results[best].inertia) {
+            best = r;
+        }
+    }
+    results[best].distance_evaluations = distance_evaluations;
+    return move(results[best]);
+}
+
+// K-means clustering with cosine similarity
+Cluster kmeans_cosine(const Cluster& data, int k, int max_iters = 100, int n_init = 1,
+                      uint64_t seed = random_device{}()) {
+    KMeansResult best = kmeans_cosine_restarts(data, k, max_iters, n_init, seed);
+    if (best.converged) {
+        cout << "Converged in " << best.iterations << " iterations." << endl;
+    }
+    return best.centroids;
+}
+
+// On-disk point file: this header followed by num_points rows of dim floats or doubles
+struct PointFileHeader {
+    char magic[4];        // "KMPT"
+    uint32_t scalar_size; // 4 for float rows, 8 for double rows
+    uint64_t num_points;
+    uint64_t dim;
+};
+
+// Write a data set in point-file format (used to convert existing data and for testing)
+void write_point_file(const string& path, const Cluster& data, bool single_precision) {
+    ofstream out(path, ios::binary);
+    if (!out) {
+        throw runtime_error("Cannot open point file for writing: " + path);
+    }
+    PointFileHeader header = {{'K', 'M', 'P', 'T'}, single_precision ? 4u : 8u,
+                              data.size(), data.empty() ? 0 : data[0].size()};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& point : data) {
+        for (double value : point) {
+            if (single_precision) {
+                float f = static_cast<float>(value);
+                out.write(reinterpret_cast<const char*>(&f), sizeof(f));
+            } else {
+                out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+            }
+        }
+    }
+}
+
+// Read-only memory mapping of a point file; rows are read in place, never copied
+class MappedPointFile {
+public:
+    explicit MappedPointFile(const string& path) {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Cannot open point file: " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(PointFileHeader))) {
+            close(fd);
+            throw runtime_error("Point file too small: " + path);
+        }
+        length = st.st_size;
+        base = static_cast<const char*>(mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0));
+        if (base == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Cannot map point file: " + path);
+        }
+
+        memcpy(&header, base, sizeof(header));
+        // Size check by division: num_points * dim * scalar_size may overflow for a bad header
+        if (memcmp(header.magic, "KMPT", 4) != 0 || (header.scalar_size != 4 && header.scalar_size != 8) ||
+            header.dim == 0 ||
+            header.num_points > (length - sizeof(header)) / header.dim / header.scalar_size) {
+            munmap(const_cast<char*>(base), length);
+            close(fd);
+            throw runtime_error("Malformed point file: " + path);
+        }
+
+        // Passes are strictly front-to-back, so ask for aggressive readahead
+        madvise(const_cast<char*>(base), length, MADV_SEQUENTIAL);
+    }
+
+    ~MappedPointFile() {
+        munmap(const_cast<char*>(base), length);
+        close(fd);
+    }
+
+    MappedPointFile(const MappedPointFile&) = delete;
+    MappedPointFile& operator=(const MappedPointFile&) = delete;
+
+    size_t size() const { return header.num_points; }
+    size_t dim() const { return header.dim; }
+    bool single_precision() const { return header.scalar_size == 4; }
+    size_t row_bytes() const { return header.dim * header.scalar_size; }
+
+    template <typename T>
+    const T* rows() const {
+        return reinterpret_cast<const T*>(base + sizeof(PointFileHeader));
+    }
+
+    // Apply an madvise hint to the pages covering rows [begin, end)
+    void advise(size_t begin, size_t end, int advice) const {
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        size_t from = sizeof(PointFileHeader) + begin * row_bytes();
+        size_t to = min<size_t>(sizeof(PointFileHeader) + end * row_bytes(), length);
+        from -= from % page;
+        if (to > from) {
+            madvise(const_cast<char*>(base) + from, to - from, advice);
+        }
+    }
+
+private:
+    int fd = -1;
+    const char* base = nullptr;
+    size_t length = 0;
+    PointFileHeader header;
+};
+
+// Cosine similarity between a raw (float or double) row and a centroid
+template <typename T>
+double cosine_similarity(const T* a, const Point& b) {
+    double dot_product = 0.0;
+    double norm_a = 0.0;
+    double norm_b = 0.0;
+    for (size_t i = 0; i < b.size(); ++i) {
+        dot_product += a[i] * b[i];
+        norm_a += static_cast<double>(a[i]) * a[i];
+        norm_b += b[i] * b[i];
+    }
+    return dot_product / (sqrt(norm_a) * sqrt(norm_b));
+}
+
+// One streaming Lloyd pass over the mapped rows: assigns each row to its nearest centroid,
+// accumulates the per-cluster sums and returns the inertia against the given centroids.
+template <typename T>
+double mapped_pass(const MappedPointFile& file, const Cluster& centroids, Cluster& sums,
+                   vector<size_t>& counts, size_t chunk_rows) {
+    const T* rows = file.rows<T>();
+    size_t n = file.size();
+    size_t dim = file.dim();
+    double inertia = 0.0;
+
+    for (size_t begin = 0; begin < n; begin += chunk_rows) {
+        size_t end = min(begin + chunk_rows, n);
+        // Prefetch the next chunk while this one is processed, and drop the one behind us
+        file.advise(end, min(end + chunk_rows, n), MADV_WILLNEED);
+        if (begin >= chunk_rows) {
+            file.advise(begin - chunk_rows, begin, MADV_DONTNEED);
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            const T* row = rows + i * dim;
+            double best_similarity = -numeric_limits<double>::infinity();
+            size_t best_cluster = 0;
+            for (size_t j = 0; j < centroids.size(); ++j) {
+                double similarity = cosine_similarity(row, centroids[j]);
+                if (similarity > best_similarity) {
+                    best_similarity = similarity;
+                    best_cluster = j;
+                }
+            }
+            inertia += 1.0 - best_similarity;
+            counts[best_cluster]++;
+            for (size_t d = 0; d < dim; ++d) {
+                sums[best_cluster][d] += row[d];
+            }
+        }
+    }
+    return inertia;
+}
+
+// Out-of-core k-means with cosine similarity over a memory-mapped point file.
+// Each iteration is one sequential pass in chunks of chunk_rows rows; memory use is
+// O(k * dim) regardless of file size, so per-point assignments are not kept.
+KMeansResult kmeans_cosine_mapped(const MappedPointFile& file, int k, int max_iters = 100,
+                                  uint64_t seed = random_device{}(), size_t chunk_rows = 1 << 16) {
+    size_t n = file.size();
+    size_t dim = file.dim();
+    if (n == 0 || k <= 0 || static_cast<size_t>(k) > n) {
+        throw invalid_argument("k must be between 1 and the number of points in the file");
+    }
+    KMeansResult result;
+    result.centroids.assign(k, Point(dim, 0.0));
+
+    // Randomly initialize centroids from rows of the file
+    mt19937_64 gen(seed);
+    uniform_int_distribution<size_t> dist(0, n - 1);
+    for (auto& centroid : result.centroids) {
+        size_t row = dist(gen);
+        for (size_t d = 0; d < dim; ++d) {
+            centroid[d] = file.single_precision() ? file.rows<float>()[row * dim + d]
+                                                  : file.rows<double>()[row * dim + d];
+        }
+    }
+
+    for (int iter = 0; iter < max_iters; ++iter) {
+        Cluster sums(k, Point(dim, 0.0));
+        vector<size_t> counts(k, 0);
+        result.inertia = file.single_precision()
+                             ? mapped_pass<float>(file, result.centroids, sums, counts, chunk_rows)
+                             : mapped_pass<double>(file, result.centroids, sums, counts, chunk_rows);
+        result.iterations = iter + 1;
+        result.distance_evaluations += uint64_t(n) * k;
+
+        Cluster new_centroids = result.centroids;
+        for (int j = 0; j < k; ++j) {
+            if (counts[j] == 0) continue;  // Keep empty clusters where they were
+            for (size_t d = 0; d < dim; ++d) {
+                new_centroids[j][d] = sums[j][d] / counts[j];
+            }
+        }
+
+        // The inertia of this pass already belongs to the final centroids
+        if (new_centroids == result.centroids) {
+            result.converged = true;
             break;
         }
-        centroids = new_centroids;
+        result.centroids = new_centroids;
     }
 
-    return centroids;
+    // Out of iterations: score the centroids being returned, as kmeans_cosine_single does
+    if (!result.converged) {
+        Cluster sums(k, Point(dim, 0.0));
+        vector<size_t> counts(k, 0);
+        result.inertia = file.single_precision()
+                             ? mapped_pass<float>(file, result.centroids, sums, counts, chunk_rows)
+                             : mapped_pass<double>(file, result.centroids, sums, counts, chunk_rows);
+        result.distance_evaluations += uint64_t(n) * k;
+    }
+    return result;
 }
 
 // Helper function to print clusters
@@ -109,7 +384,19 @@ void print_clusters(const Cluster& centroids) {
     }
 }
 
-int main() {
+// Define KMEANS_NO_MAIN to reuse this file from other programs (e.g. KMeansBenchmark.cpp)
+#ifndef KMEANS_NO_MAIN
+int main(int argc, char* argv[]) {
+    // Cluster a point file out of core when one is given: <points.bin> [k]
+    if (argc > 1) {
+        MappedPointFile file(argv[1]);
+        int k = argc > 2 ? atoi(argv[2]) : 2;
+        KMeansResult result = kmeans_cosine_mapped(file, k);
+        cout << "Iterations: " << result.iterations << ", inertia: " << result.inertia << endl;
+        print_clusters(result.centroids);
+        return 0;
+    }
+
     // Sample data points in a high-dimensional space (e.g., embeddings)
     Cluster data = {
         {0.2, 0.3, 0.5},
@@ -121,6 +408,8 @@ int main() {
 
     int k = 2; // Number of clusters
     int max_iters = 100;
+    int n_init = 8;     // Independent restarts, best inertia wins
+    uint64_t seed = 42; // Fixed seed for reproducible runs
 
     // Normalize data for cosine similarity
     for (auto& point : data) {
@@ -130,8 +419,17 @@ int main() {
         }
     }
 
-    Cluster centroids = kmeans_cosine(data, k, max_iters);
+    Cluster centroids = kmeans_cosine(data, k, max_iters, n_init, seed);
     print_clusters(centroids);
 
+    // Same data clustered out of core through a memory-mapped point file
+    write_point_file("kmeans_points.bin", data, true);
+    MappedPointFile file("kmeans_points.bin");
+    KMeansResult mapped = kmeans_cosine_mapped(file, k, max_iters, seed);
+    cout << "Out-of-core inertia: " << mapped.inertia << endl;
+    print_clusters(mapped.centroids);
+    remove("kmeans_points.bin");
+
     return 0;
 }
+#endif
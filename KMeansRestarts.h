@@ -0,0 +1,48 @@
+// Concurrent k-means restarts shared by KMeansClusterFormationSpecialized.cpp and the
+// HMM time-series forecast program, so both engines derive restart seeds the same way.
+#ifndef KMEANS_RESTARTS_H
+#define KMEANS_RESTARTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Run run(seed) for n_init restarts (at least one) across the cores and return the results in
+// restart order. Restart 0 uses `seed` itself, so it reproduces a single run with that seed and
+// more restarts can only improve on it; the others draw their seeds from an mt19937_64 seeded
+// with `seed`. Results do not depend on how many threads run the restarts.
+template <typename Result, typename Run>
+std::vector<Result> run_restarts(int n_init, uint64_t seed, Run run) {
+    n_init = std::max(n_init, 1);
+    std::vector<uint64_t> seeds(n_init);
+    seeds[0] = seed;
+    std::mt19937_64 seeder(seed);
+    for (int r = 1; r < n_init; ++r) {
+        seeds[r] = seeder();
+    }
+
+    std::vector<Result> results(n_init);
+    std::atomic<int> next_restart(0);
+    auto worker = [&]() {
+        for (int r = next_restart++; r < n_init; r = next_restart++) {
+            results[r] = run(seeds[r]);
+        }
+    };
+
+    // The data is shared read-only; each restart owns its own state
+    int num_threads = std::min<int>(n_init, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    return results;
+}
+
+#endif
@@ -7,13 +7,91 @@ using namespace std;
 
 typedef vector<complex<double>> QuantumState;
 
+// 2x2 gate matrix {m00, m01, m10, m11}. Every operation on it is constexpr, so gates built
+// from constant angles are multiplied together by the compiler.
+struct Gate2 {
+    complex<double> m[4];
+};
+
+constexpr complex<double> cmul(complex<double> a, complex<double> b) {
+    return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+}
+
+constexpr complex<double> cadd(complex<double> a, complex<double> b) {
+    return {a.real() + b.real(), a.imag() + b.imag()};
+}
+
+// Fused gate: applying (a * b) equals applying b, then a
+constexpr Gate2 operator*(const Gate2& a, const Gate2& b) {
+    return {{cadd(cmul(a.m[0], b.m[0]), cmul(a.m[1], b.m[2])), cadd(cmul(a.m[0], b.m[1]), cmul(a.m[1], b.m[3])),
+             cadd(cmul(a.m[2], b.m[0]), cmul(a.m[3], b.m[2])), cadd(cmul(a.m[2], b.m[1]), cmul(a.m[3], b.m[3]))}};
+}
+
+// Compile-time sine and cosine (Taylor series after reduction to [-pi, pi])
+constexpr double reduceAngle(double x) {
+    while (x > M_PI) x -= 2 * M_PI;
+    while (x < -M_PI) x += 2 * M_PI;
+    return x;
+}
+
+constexpr double constexprSin(double x) {
+    x = reduceAngle(x);
+    double term = x, sum = x;
+    for (int n = 1; n < 30; ++n) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double constexprCos(double x) {
+    x = reduceAngle(x);
+    double term = 1.0, sum = 1.0;
+    for (int n = 1; n < 30; ++n) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+// Hadamard, phase and rotation gates as matrices
+constexpr Gate2 hadamardGate() {
+    constexpr double sqrt2_inv = 0.70710678118654752440;
+    return {{sqrt2_inv, sqrt2_inv, sqrt2_inv, -sqrt2_inv}};
+}
+
+constexpr Gate2 phaseGate(double phase_angle) {
+    return {{1.0, 0.0, 0.0, complex<double>(constexprCos(phase_angle), constexprSin(phase_angle))}};
+}
+
+constexpr Gate2 rotationGate(double angle) {
+    return {{constexprCos(angle), -constexprSin(angle), constexprSin(angle), constexprCos(angle)}};
+}
+
+// Apply a (possibly fused) gate in a single in-place pass over the state
+void applyGate(QuantumState& state, const Gate2& gate) {
+    complex<double> a0 = state[0], a1 = state[1];
+    state[0] = gate.m[0] * a0 + gate.m[1] * a1;
+    state[1] = gate.m[2] * a0 + gate.m[3] * a1;
+}
+
+// Collects gates while a circuit is built and multiplies them into one, so the state is
+// touched once however many gates were added
+class FusedGate {
+public:
+    FusedGate& then(const Gate2& gate) {
+        total = gate * total;
+        return *this;
+    }
+    const Gate2& gate() const { return total; }
+
+private:
+    Gate2 total = {{1.0, 0.0, 0.0, 1.0}};
+};
+
 // Define the Hadamard Gate in 2D space
 void applyHadamard(QuantumState& state) {
-    const double sqrt2_inv = 1.0 / sqrt(2.0);
-    QuantumState new_state(2);
-    new_state[0] = sqrt2_inv * (state[0] + state[1]);
-    new_state[1] = sqrt2_inv * (state[0] - state[1]);
-    state = new_state;
+    applyGate(state, hadamardGate());
 }
 
 // Apply a phase shift (phase gate)
@@ -23,22 +101,23 @@ void applyPhase(QuantumState& state, double phase_angle) {
 
 // Define a 4D rotation in hyperspace (generalized rotation)
 void applyRotation(QuantumState& state, double angle) {
-    QuantumState new_state(2);
-    new_state[0] = cos(angle) * state[0] - sin(angle) * state[1];
-    new_state[1] = sin(angle) * state[0] + cos(angle) * state[1];
-    state = new_state;
+    applyGate(state, rotationGate(angle));
 }
 
+// The gateway's Hadamard, 45 degree phase and 30 degree rotation, fused at compile time
+constexpr Gate2 gatewayGate = rotationGate(M_PI / 6) * phaseGate(M_PI / 4) * hadamardGate();
+
 // Quantum Gateway that applies multiple linear transformations across different dimensions
+// (Hadamard, phase shift, 4D rotation) as one fused gate in a single pass
 void quantumGateway(QuantumState& state) {
-    // Apply a Hadamard transformation in one "dimension"
-    applyHadamard(state);
-
-    // Apply a phase shift in another "dimension"
-    applyPhase(state, M_PI / 4); // Phase shift of 45 degrees
+    applyGate(state, gatewayGate);
+}
 
-    // Apply a 4D rotation in hyperspace
-    applyRotation(state, M_PI / 6); // Rotate by 30 degrees
+// Same gateway with angles only known at run time, fused when the circuit is built
+void quantumGateway(QuantumState& state, double phase_angle, double rotation_angle) {
+    FusedGate gateway;
+    gateway.then(hadamardGate()).then(phaseGate(phase_angle)).then(rotationGate(rotation_angle));
+    applyGate(state, gateway.gate());
 }
 
 int main() {
@@ -52,13 +131,25 @@ int main() {
     cout << endl;
 
     // Pass the state through the quantum gateway
+    QuantumState unfused = state;
     quantumGateway(state);
 
+    // The three gates applied one after another give the same state
+    applyHadamard(unfused);
+    applyPhase(unfused, M_PI / 4);
+    applyRotation(unfused, M_PI / 6);
+
     cout << "State after quantum gateway: ";
     for (auto& amp : state) {
         cout << amp << " ";
     }
     cout << endl;
 
+    cout << "Gate by gate:                ";
+    for (auto& amp : unfused) {
+        cout << amp << " ";
+    }
+    cout << endl;
+
     return 0;
 }
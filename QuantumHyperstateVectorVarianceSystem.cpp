@@ -2,6 +2,11 @@
 #include <vector>
 #include <complex>
 #include <cmath>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std;
 
@@ -49,23 +54,200 @@ double expectationValue(const vector<vector<Complex>>& observable, const Quantum
     return expValue.real();
 }
 
-// Calculate the variance of an observable
-double variance(const vector<vector<Complex>>& observable, const QuantumState& state) {
-    double expVal = expectationValue(observable, state);
+// Mean <O>, second moment <O^2> and variance of a Hermitian observable in a state.
+// Both moments come from one application of O: <O> = Re<state|O state> and, since O is
+// Hermitian, <O^2> = <O state|O state> = ||O state||^2. No O^2 (or n x n matrix) is formed.
+struct ObservableMoments {
+    double mean = 0.0;
+    double secondMoment = 0.0;
+    double variance = 0.0;
+};
+
+ObservableMoments momentsFromProduct(const QuantumState& state, const QuantumState& product) {
+    ObservableMoments m;
+    for (size_t i = 0; i < state.size(); ++i) {
+        m.mean += (conj(state[i]) * product[i]).real();
+        m.secondMoment += norm(product[i]);
+    }
+    m.variance = m.secondMoment - m.mean * m.mean;
+    return m;
+}
+
+// Observable stored by its diagonal (e.g. energies of basis states)
+struct DiagonalObservable {
+    vector<double> values;
+};
+
+// Sparse observable in compressed-row form: row i holds columns[rowOffsets[i] .. rowOffsets[i + 1])
+struct SparseObservable {
+    size_t dimension = 0;
+    vector<size_t> rowOffsets;
+    vector<size_t> columns;
+    vector<Complex> values;
+
+    // Build from (row, column, value) entries in any order; repeated entries are summed
+    static SparseObservable fromEntries(size_t dimension, vector<tuple<size_t, size_t, Complex>> entries) {
+        sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+            return make_pair(get<0>(a), get<1>(a)) < make_pair(get<0>(b), get<1>(b));
+        });
+        SparseObservable o;
+        o.dimension = dimension;
+        o.rowOffsets.assign(dimension + 1, 0);
+        for (const auto& [row, column, value] : entries) {
+            if (row >= dimension || column >= dimension) {
+                throw out_of_range("Sparse observable entry outside the matrix.");
+            }
+            if (!o.columns.empty() && o.rowOffsets[row + 1] == o.columns.size() && o.columns.back() == column) {
+                o.values.back() += value;
+                continue;
+            }
+            o.columns.push_back(column);
+            o.values.push_back(value);
+            o.rowOffsets[row + 1] = o.columns.size();
+        }
+        for (size_t i = 1; i <= dimension; ++i) {
+            o.rowOffsets[i] = max(o.rowOffsets[i], o.rowOffsets[i - 1]);
+        }
+        return o;
+    }
+};
+
+// One weighted Pauli string on qubits 0..63. Qubit q carries X if bit q of xMask is set, Z if
+// bit q of zMask is set, and Y if both are, so the string maps basis state |j> to
+// i^popcount(x & z) * (-1)^popcount(j & z) * |j ^ x>.
+struct PauliTerm {
+    Complex coefficient;
+    uint64_t xMask = 0;
+    uint64_t zMask = 0;
+};
 
-    // Calculate (O^2) and then compute <state|O^2|state>
-    vector<vector<Complex>> observableSquared(observable.size(), vector<Complex>(observable.size(), 0.0));
+// Sum of weighted Pauli strings; real coefficients make it Hermitian
+struct PauliObservable {
+    vector<PauliTerm> terms;
 
+    // Add coefficient * (ops[0] on qubit 0) (ops[1] on qubit 1) ..., each op one of I, X, Y, Z
+    PauliObservable& add(Complex coefficient, const string& ops) {
+        if (ops.size() > 64) {
+            throw invalid_argument("Pauli strings may act on at most 64 qubits.");
+        }
+        PauliTerm term{coefficient, 0, 0};
+        for (size_t q = 0; q < ops.size(); ++q) {
+            uint64_t bit = uint64_t(1) << q;
+            switch (ops[q]) {
+            case 'I': break;
+            case 'X': term.xMask |= bit; break;
+            case 'Y': term.xMask |= bit; term.zMask |= bit; break;
+            case 'Z': term.zMask |= bit; break;
+            default: throw invalid_argument("Pauli strings may only contain I, X, Y and Z.");
+            }
+        }
+        terms.push_back(term);
+        return *this;
+    }
+};
+
+// O|state> for each observable form; none of them builds an n x n matrix. The observable must
+// have the state's dimension (invalid_argument otherwise).
+void checkDimension(size_t dimension, const QuantumState& state) {
+    if (dimension != state.size()) {
+        throw invalid_argument("Observable dimension does not match the state.");
+    }
+}
+
+QuantumState applyObservable(const vector<vector<Complex>>& observable, const QuantumState& state) {
+    checkDimension(observable.size(), state);
+    for (const auto& row : observable) checkDimension(row.size(), state);
+    QuantumState result(state.size(), 0.0);
     for (size_t i = 0; i < observable.size(); ++i) {
         for (size_t j = 0; j < observable[i].size(); ++j) {
-            for (size_t k = 0; k < observable.size(); ++k) {
-                observableSquared[i][j] += observable[i][k] * observable[k][j];
+            result[i] += observable[i][j] * state[j];
+        }
+    }
+    return result;
+}
+
+QuantumState applyObservable(const SparseObservable& observable, const QuantumState& state) {
+    checkDimension(observable.dimension, state);
+    QuantumState result(state.size(), 0.0);
+    for (size_t i = 0; i < observable.dimension; ++i) {
+        Complex sum(0.0, 0.0);
+        for (size_t k = observable.rowOffsets[i]; k < observable.rowOffsets[i + 1]; ++k) {
+            sum += observable.values[k] * state[observable.columns[k]];
+        }
+        result[i] = sum;
+    }
+    return result;
+}
+
+// Terms sharing an X mask move amplitudes to the same partner index, so they are applied
+// together in one pass over the state
+QuantumState applyObservable(const PauliObservable& observable, const QuantumState& state) {
+    for (const auto& term : observable.terms) {
+        if (term.xMask >= state.size() || term.zMask >= state.size()) {
+            throw out_of_range("Pauli string acts on more qubits than the state has.");
+        }
+    }
+    vector<PauliTerm> terms = observable.terms;
+    sort(terms.begin(), terms.end(), [](const PauliTerm& a, const PauliTerm& b) { return a.xMask < b.xMask; });
+
+    static const Complex iPowers[4] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    QuantumState result(state.size(), 0.0);
+    for (size_t first = 0; first < terms.size();) {
+        size_t last = first;
+        while (last < terms.size() && terms[last].xMask == terms[first].xMask) ++last;
+
+        const uint64_t x = terms[first].xMask;
+        vector<Complex> weights;
+        for (size_t t = first; t < last; ++t) {
+            weights.push_back(terms[t].coefficient * iPowers[__builtin_popcountll(x & terms[t].zMask) & 3]);
+        }
+        for (size_t j = 0; j < state.size(); ++j) {
+            Complex factor(0.0, 0.0);
+            for (size_t t = first; t < last; ++t) {
+                double sign = (__builtin_popcountll(j & terms[t].zMask) & 1) ? -1.0 : 1.0;
+                factor += sign * weights[t - first];
             }
+            result[j ^ x] += factor * state[j];
         }
+        first = last;
+    }
+    return result;
+}
+
+ObservableMoments moments(const vector<vector<Complex>>& observable, const QuantumState& state) {
+    return momentsFromProduct(state, applyObservable(observable, state));
+}
+
+ObservableMoments moments(const SparseObservable& observable, const QuantumState& state) {
+    return momentsFromProduct(state, applyObservable(observable, state));
+}
+
+ObservableMoments moments(const PauliObservable& observable, const QuantumState& state) {
+    return momentsFromProduct(state, applyObservable(observable, state));
+}
+
+// Diagonal observables need no product state: <O> = sum d|a|^2, <O^2> = sum d^2|a|^2
+ObservableMoments moments(const DiagonalObservable& observable, const QuantumState& state) {
+    checkDimension(observable.values.size(), state);
+    ObservableMoments m;
+    for (size_t i = 0; i < state.size(); ++i) {
+        double p = norm(state[i]);
+        m.mean += observable.values[i] * p;
+        m.secondMoment += observable.values[i] * observable.values[i] * p;
     }
+    m.variance = m.secondMoment - m.mean * m.mean;
+    return m;
+}
 
-    double expValSquared = expectationValue(observableSquared, state);
-    return expValSquared - expVal * expVal;
+template <typename Observable>
+double expectationValue(const Observable& observable, const QuantumState& state) {
+    return moments(observable, state).mean;
+}
+
+// Calculate the variance of an observable
+template <typename Observable>
+double variance(const Observable& observable, const QuantumState& state) {
+    return moments(observable, state).variance;
 }
 
 // Generate a hyperstate (superposition of two states)
@@ -99,5 +281,29 @@ int main() {
     cout << "Expectation Value: " << expValue << endl;
     cout << "Variance: " << var << endl;
 
+    // The same observable as a diagonal and as the Pauli sum 1.5 I - 0.5 Z
+    DiagonalObservable diagonal{{1.0, 2.0}};
+    PauliObservable pauli;
+    pauli.add(1.5, "I").add(-0.5, "Z");
+    cout << "Diagonal form: " << expectationValue(diagonal, hyperstate) << ", " << variance(diagonal, hyperstate) << endl;
+    cout << "Pauli form: " << expectationValue(pauli, hyperstate) << ", " << variance(pauli, hyperstate) << endl;
+
+    // Transverse-field Ising energy on 20 qubits (a 2^20-dimensional state)
+    const int qubits = 20;
+    PauliObservable ising;
+    for (int q = 0; q < qubits; ++q) {
+        string zz(qubits, 'I'), x(qubits, 'I');
+        zz[q] = 'Z';
+        zz[(q + 1) % qubits] = 'Z';
+        x[q] = 'X';
+        ising.add(-1.0, zz).add(-0.5, x);
+    }
+    QuantumState large(size_t(1) << qubits);
+    for (size_t i = 0; i < large.size(); ++i) {
+        large[i] = Complex(cos(0.001 * i), sin(0.003 * i));
+    }
+    ObservableMoments energy = moments(ising, normalize(large));
+    cout << "Ising energy: " << energy.mean << ", variance: " << energy.variance << endl;
+
     return 0;
 }
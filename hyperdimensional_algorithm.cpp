@@ -3,12 +3,2115 @@
 #include <complex>
 #include <random>
 #include <cmath>
+#include <array>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <numeric>
+#include <type_traits>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+using Amplitude = std::complex<double>;
+
+// Persistent pool of worker threads for amplitude loops. parallel_for splits [0, count) into
+// one contiguous range per worker (the caller is worker 0) and returns once all are done.
+class ThreadPool {
+public:
+    explicit ThreadPool(int num_threads = 0) {
+        int n = num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+        for (int w = 1; w < n; ++w) {
+            workers.emplace_back([this, w] { worker_loop(w); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            ++generation;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Run body(begin, end) over [0, count); small counts run inline on the calling thread, as
+    // do calls made while the pool is already busy (from inside a body, or from another
+    // thread), so callers that parallelize at a coarser level can still use pooled kernels.
+    // The first exception thrown by body is rethrown on the caller once every worker is done.
+    void parallel_for(size_t count, size_t min_per_worker, const std::function<void(size_t, size_t)>& body) {
+        size_t n = std::min<size_t>(size(), count / std::max<size_t>(min_per_worker, 1));
+        if (n <= 1 || busy.exchange(true)) {
+            if (count > 0) body(0, count);
+            return;
+        }
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = [&body, &error, &error_mutex, count, n](int worker) {
+                size_t begin = count * worker / n, end = count * (worker + 1) / n;
+                try {
+                    if (begin < end) body(begin, end);
+                } catch (...) {
+                    std::lock_guard<std::mutex> error_lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+            };
+            active = n;
+            pending = n - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        job(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        busy = false;
+        if (error) std::rethrow_exception(error);
+    }
+
+    // Shared pool used by the state-vector kernels
+    static ThreadPool& instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    void worker_loop(int w) {
+        size_t seen = 0;
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return generation != seen; });
+            seen = generation;
+            if (stopping) return;
+            if (static_cast<size_t>(w) >= active) continue;
+            auto task = job;
+            lock.unlock();
+            task(w);
+            lock.lock();
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::function<void(int)> job;
+    size_t generation = 0, active = 0, pending = 0;
+    bool stopping = false;
+    std::atomic<bool> busy{false};
+};
+
+// Single-qubit gate as a row-major 2x2 matrix {m00, m01, m10, m11}
+struct Gate {
+    std::array<Amplitude, 4> m;
+};
+
+// Matrix product: applying (a * b) equals applying b, then a
+Gate operator*(const Gate& a, const Gate& b) {
+    return {{a.m[0] * b.m[0] + a.m[1] * b.m[2], a.m[0] * b.m[1] + a.m[1] * b.m[3],
+             a.m[2] * b.m[0] + a.m[3] * b.m[2], a.m[2] * b.m[1] + a.m[3] * b.m[3]}};
+}
+
+// Conjugate transpose, the inverse of a unitary gate
+Gate adjoint(const Gate& g) {
+    return {{std::conj(g.m[0]), std::conj(g.m[2]), std::conj(g.m[1]), std::conj(g.m[3])}};
+}
+
+// Structure of a gate matrix, used to pick a cheaper kernel than the dense 2x2 update
+enum class GateKind {
+    General,
+    Diagonal,     // Phase, Z, RZ, controlled-phase: each amplitude is only scaled
+    AntiDiagonal  // X, Y, CNOT: amplitude pairs are exchanged (with phases)
+};
+
+GateKind classify(const Gate& g) {
+    const Amplitude zero(0.0, 0.0);
+    if (g.m[1] == zero && g.m[2] == zero) return GateKind::Diagonal;
+    if (g.m[0] == zero && g.m[3] == zero) return GateKind::AntiDiagonal;
+    return GateKind::General;
+}
+
+Gate hadamard_gate() {
+    const double h = 1.0 / std::sqrt(2.0);
+    return {{h, h, h, -h}};
+}
+Gate pauli_x_gate() { return {{0.0, 1.0, 1.0, 0.0}}; }
+Gate pauli_y_gate() { return {{0.0, Amplitude(0, -1), Amplitude(0, 1), 0.0}}; }
+Gate pauli_z_gate() { return {{1.0, 0.0, 0.0, -1.0}}; }
+Gate phase_gate(double angle) { return {{1.0, 0.0, 0.0, std::polar(1.0, angle)}}; }
+Gate rx_gate(double angle) {
+    double c = std::cos(angle / 2), s = std::sin(angle / 2);
+    return {{c, Amplitude(0, -s), Amplitude(0, -s), c}};
+}
+Gate ry_gate(double angle) {
+    double c = std::cos(angle / 2), s = std::sin(angle / 2);
+    return {{c, -s, s, c}};
+}
+Gate rz_gate(double angle) {
+    return {{std::polar(1.0, -angle / 2), 0.0, 0.0, std::polar(1.0, angle / 2)}};
+}
+
+Gate identity_gate() { return {{1.0, 0.0, 0.0, 1.0}}; }
+
+// Axis of a parameterized single-qubit gate
+enum class Rotation { X, Y, Z, Phase };
+
+Gate rotation_gate(Rotation axis, double angle) {
+    switch (axis) {
+    case Rotation::X: return rx_gate(angle);
+    case Rotation::Y: return ry_gate(angle);
+    case Rotation::Z: return rz_gate(angle);
+    case Rotation::Phase: return phase_gate(angle);
+    }
+    throw std::invalid_argument("Unknown rotation axis.");
+}
+
+// Checkpoint file layout: this header, zero padding up to amplitude_offset (a page multiple,
+// so the amplitudes can be mapped in place), then 2^num_qubits interleaved (re, im) values
+struct CheckpointHeader {
+    char magic[4];             // "QSVC"
+    uint32_t scalar_size;      // 4 for float amplitudes, 8 for double
+    uint32_t num_qubits;
+    uint32_t reserved;
+    uint64_t position;         // Number of circuit operations already applied
+    uint64_t amplitude_offset; // Byte offset of the first amplitude
+};
+
+constexpr size_t kCheckpointAlignment = 4096;
+// Checkpoints are read and written in sequential chunks of this size
+constexpr size_t kCheckpointChunk = size_t(64) << 20;
+
+// Storage for the amplitudes: an owned heap array, or a private (copy-on-write) mapping of a
+// checkpoint file. A mapped buffer pages the state in on first touch instead of reading and
+// copying it up front, and never writes back to the file.
+template <typename T>
+class AmplitudeBuffer {
+public:
+    AmplitudeBuffer() = default;
+
+    AmplitudeBuffer(const AmplitudeBuffer& other) : owned(other.begin(), other.end()) { reset_view(); }
+    AmplitudeBuffer(AmplitudeBuffer&& other) noexcept { swap(other); }
+    AmplitudeBuffer& operator=(AmplitudeBuffer other) noexcept {
+        swap(other);
+        return *this;
+    }
+    ~AmplitudeBuffer() {
+        if (mapping) munmap(mapping, mapping_length);
+    }
+
+    void assign(size_t count, const T& value) {
+        release_mapping();
+        owned.assign(count, value);
+        reset_view();
+    }
+
+    // Map `count` values starting `offset` bytes into the open file (offset is page aligned)
+    static AmplitudeBuffer map_file(int fd, size_t offset, size_t count) {
+        AmplitudeBuffer buffer;
+        buffer.mapping_length = offset + count * sizeof(T);
+        void* base = mmap(nullptr, buffer.mapping_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("Cannot map checkpoint file.");
+        }
+        buffer.mapping = base;
+        buffer.values = reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        buffer.length = count;
+        return buffer;
+    }
+
+    bool mapped() const { return mapping != nullptr; }
+    size_t size() const { return length; }
+    T* data() { return values; }
+    const T* data() const { return values; }
+    T& operator[](size_t index) { return values[index]; }
+    const T& operator[](size_t index) const { return values[index]; }
+    T* begin() { return values; }
+    T* end() { return values + length; }
+    const T* begin() const { return values; }
+    const T* end() const { return values + length; }
+
+private:
+    void swap(AmplitudeBuffer& other) noexcept {
+        owned.swap(other.owned);
+        std::swap(values, other.values);
+        std::swap(length, other.length);
+        std::swap(mapping, other.mapping);
+        std::swap(mapping_length, other.mapping_length);
+    }
+
+    void reset_view() {
+        values = owned.data();
+        length = owned.size();
+    }
+
+    void release_mapping() {
+        if (mapping) munmap(mapping, mapping_length);
+        mapping = nullptr;
+        mapping_length = 0;
+    }
+
+    std::vector<T> owned;
+    T* values = nullptr;
+    size_t length = 0;
+    void* mapping = nullptr;
+    size_t mapping_length = 0;
+};
+
+// State vector of N qubits: 2^N amplitudes, qubit q is bit q of the basis index.
+// Gates are applied in place by visiting amplitude pairs that differ only in the target bit
+// (stride 2^target), so no 2^N x 2^N matrix is ever formed and no extra vector is allocated.
+// Real selects the precision: complex<double> takes 16 bytes per amplitude (30 qubits = 16 GiB),
+// complex<float> takes 8, which fits one more qubit in the same memory and halves the
+// traffic of every gate. Gates stay in double precision and are rounded per kernel call.
+template <typename Real>
+class BasicStateVector {
+public:
+    using Value = std::complex<Real>;
+
+    explicit BasicStateVector(int num_qubits) : qubits(num_qubits) {
+        if (num_qubits < 1 || num_qubits > 40) {
+            throw std::invalid_argument("StateVector supports 1 to 40 qubits.");
+        }
+        amplitudes.assign(size_t(1) << num_qubits, Value(0.0, 0.0));
+        amplitudes[0] = 1.0; // |0...0>
+    }
+
+    int num_qubits() const { return qubits; }
+    size_t size() const { return amplitudes.size(); }
+    Value& operator[](size_t index) { return amplitudes[index]; }
+    const Value& operator[](size_t index) const { return amplitudes[index]; }
+    Value* data() { return amplitudes.data(); }
+    const Value* data() const { return amplitudes.data(); }
+    bool mapped() const { return amplitudes.mapped(); }
+
+    // <this|ket>
+    std::complex<double> inner_product(const BasicStateVector& ket) const {
+        return gate_matrix_element(identity_gate(), 0, -1, ket);
+    }
+
+    // <this| G |ket> for a single-qubit gate on `target`, computed pair by pair without forming
+    // G|ket>. With control >= 0 only basis states whose control bit is 1 contribute (the
+    // operator is |1><1| on the control times G), which is the derivative of a controlled
+    // rotation.
+    std::complex<double> gate_matrix_element(const Gate& gate, int target, int control, const BasicStateVector& ket) const {
+        check_qubit(target);
+        if (ket.qubits != qubits) {
+            throw std::invalid_argument("States have different numbers of qubits.");
+        }
+        std::vector<int> fixed_bits = {target};
+        size_t control_mask = 0;
+        if (control >= 0) {
+            check_qubit(control);
+            fixed_bits.push_back(control);
+            control_mask = size_t(1) << control;
+        }
+        const size_t stride = size_t(1) << target;
+        return reduce_runs(fixed_bits, control_mask, [&](size_t first, size_t step, size_t count) {
+            std::complex<double> sum = 0.0;
+            for (size_t i = first; i < first + count * step; i += step) {
+                std::complex<double> k0(ket.amplitudes[i]), k1(ket.amplitudes[i + stride]);
+                sum += std::conj(std::complex<double>(amplitudes[i])) * (gate.m[0] * k0 + gate.m[1] * k1) +
+                       std::conj(std::complex<double>(amplitudes[i + stride])) * (gate.m[2] * k0 + gate.m[3] * k1);
+            }
+            return sum;
+        });
+    }
+
+    // Write the state and the circuit position to `path` with large sequential writes. The
+    // file is written under a temporary name, synced and renamed over `path`, so a job killed
+    // mid-write leaves the previous checkpoint intact. This is safe while the state itself
+    // is mapped from `path`: the mapping keeps the old file alive.
+    void save_checkpoint(const std::string& path, uint64_t position) const {
+        CheckpointHeader header = {{'Q', 'S', 'V', 'C'}, uint32_t(sizeof(Real)), uint32_t(qubits), 0u,
+                                   position, kCheckpointAlignment};
+        std::vector<char> head(kCheckpointAlignment, 0);
+        std::memcpy(head.data(), &header, sizeof(header));
+
+        const std::string temporary = path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open checkpoint for writing: " + temporary);
+        }
+        bool ok = write_all(fd, head.data(), head.size()) &&
+                  write_all(fd, reinterpret_cast<const char*>(amplitudes.data()), size() * sizeof(Value)) &&
+                  fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Cannot write checkpoint: " + path);
+        }
+    }
+
+    // Restore a state saved by save_checkpoint; the saved circuit position is stored in
+    // *position when given. With map_in_place the file is mapped as the working state, so
+    // resuming costs no read pass: pages load as gates first touch them, and updates stay in
+    // private memory. Otherwise the amplitudes are read into memory in large chunks.
+    static BasicStateVector load_checkpoint(const std::string& path, uint64_t* position = nullptr,
+                                            bool map_in_place = true) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open checkpoint: " + path);
+        }
+        try {
+            CheckpointHeader header;
+            struct stat st;
+            // Amplitudes must start after the header and fill the rest of the file exactly; the
+            // size is checked by division so a huge amplitude_offset cannot wrap the sum
+            if (!read_all(fd, reinterpret_cast<char*>(&header), sizeof(header)) || fstat(fd, &st) != 0 ||
+                std::memcmp(header.magic, "QSVC", 4) != 0 || header.scalar_size != sizeof(Real) ||
+                header.num_qubits < 1 || header.num_qubits > 40 || header.amplitude_offset % kCheckpointAlignment != 0 ||
+                header.amplitude_offset < sizeof(header) || header.amplitude_offset > uint64_t(st.st_size) ||
+                (uint64_t(st.st_size) - header.amplitude_offset) % sizeof(Value) != 0 ||
+                (uint64_t(st.st_size) - header.amplitude_offset) / sizeof(Value) != (uint64_t(1) << header.num_qubits)) {
+                throw std::runtime_error("Not a checkpoint of this precision: " + path);
+            }
+
+            BasicStateVector state;
+            state.qubits = header.num_qubits;
+            const size_t count = size_t(1) << header.num_qubits;
+            if (map_in_place) {
+                state.amplitudes = AmplitudeBuffer<Value>::map_file(fd, header.amplitude_offset, count);
+            } else {
+                state.amplitudes.assign(count, Value(0.0, 0.0));
+                if (lseek(fd, off_t(header.amplitude_offset), SEEK_SET) < 0 ||
+                    !read_all(fd, reinterpret_cast<char*>(state.amplitudes.data()), count * sizeof(Value))) {
+                    throw std::runtime_error("Truncated checkpoint: " + path);
+                }
+            }
+            close(fd);
+            if (position) *position = header.position;
+            return state;
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    // Apply a single-qubit gate to `target`
+    void apply_gate(const Gate& gate, int target) {
+        apply_pairs(gate, target, 0);
+    }
+
+    // Apply `gate` to `target` on the basis states where `control` is 1
+    void apply_controlled_gate(const Gate& gate, int control, int target) {
+        check_qubit(control);
+        if (control == target) {
+            throw std::invalid_argument("Control and target qubits must differ.");
+        }
+        apply_pairs(gate, target, size_t(1) << control);
+    }
+
+    void apply_cnot(int control, int target) { apply_controlled_gate(pauli_x_gate(), control, target); }
+    void apply_cz(int control, int target) { apply_controlled_gate(pauli_z_gate(), control, target); }
+
+    // Exchange qubits a and b: a pure permutation, done by swapping the amplitudes whose
+    // a and b bits differ
+    void apply_swap(int a, int b) {
+        check_qubit(a);
+        check_qubit(b);
+        if (a == b) return;
+        const std::ptrdiff_t offset = (std::ptrdiff_t(1) << b) - (std::ptrdiff_t(1) << a);
+        for_each_run({a, b}, size_t(1) << a, [&](Value* first, size_t step, size_t count) {
+            for (size_t k = 0; k < count * step; k += step) {
+                std::swap(first[k], first[k + offset]);
+            }
+        });
+    }
+
+    double norm_squared() const {
+        double sum = 0.0;
+        for (const auto& a : amplitudes) sum += std::norm(a);
+        return sum;
+    }
+
+    void normalize() {
+        double scale = 1.0 / std::sqrt(norm_squared());
+        for (auto& a : amplitudes) a *= Real(scale);
+    }
+
+    // Normalization drift check. Gates are unitary, so the norm is preserved exactly in exact
+    // arithmetic, but each gate rounds every amplitude with relative error ~epsilon (6e-8 for
+    // float, 1e-16 for double), so |norm^2 - 1| creeps up with circuit depth. Call this every
+    // few hundred gates: it returns the drift and renormalizes the state when the drift exceeds
+    // `tolerance`. The default kDriftTolerance (1e-5 for float, 1e-12 for double) keeps
+    // probabilities accurate to that many digits.
+    double check_normalization(double tolerance = kDriftTolerance) {
+        double drift = std::abs(norm_squared() - 1.0);
+        if (drift > tolerance) normalize();
+        return drift;
+    }
+
+    // Draw `shots` basis-state indices from the |amplitude|^2 distribution, returned in
+    // increasing order (shots are exchangeable; shuffle them if order matters).
+    // The state is split into fixed blocks whose probability totals form a cumulative table,
+    // computed in parallel. Sorted uniforms are generated directly from exponential spacings,
+    // and each block then walks its amplitudes once, emitting the uniforms that fall inside
+    // it, so any number of shots costs about one pass over the state. Results depend only on
+    // the seed, not on the number of threads.
+    std::vector<uint64_t> sample(size_t shots, uint64_t seed) const {
+        std::vector<uint64_t> outcomes(shots);
+        if (shots == 0) return outcomes;
+
+        const size_t block = std::min(kSampleBlock, amplitudes.size());
+        const size_t num_blocks = amplitudes.size() / block;
+        std::vector<double> cumulative(num_blocks + 1, 0.0);
+        ThreadPool::instance().parallel_for(num_blocks, kMinPairsPerWorker / block + 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                double sum = 0.0;
+                for (size_t i = b * block; i < (b + 1) * block; ++i) sum += std::norm(amplitudes[i]);
+                cumulative[b + 1] = sum;
+            }
+        });
+        std::partial_sum(cumulative.begin(), cumulative.end(), cumulative.begin());
+        const double total = cumulative.back();
+        if (!(total > 0.0)) {
+            throw std::runtime_error("Cannot sample from a zero state.");
+        }
+
+        // The k-th of shots sorted uniforms is S_k / S_(shots+1) for partial sums S of
+        // independent exponentials
+        std::mt19937_64 gen(seed);
+        std::exponential_distribution<double> spacing(1.0);
+        std::vector<double> targets(shots);
+        double running = 0.0;
+        for (auto& t : targets) t = running += spacing(gen);
+        const double scale = total / (running + spacing(gen));
+        for (auto& t : targets) t *= scale;
+
+        ThreadPool::instance().parallel_for(num_blocks, kMinPairsPerWorker / block + 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                size_t first = std::lower_bound(targets.begin(), targets.end(), cumulative[b]) - targets.begin();
+                size_t last = std::lower_bound(targets.begin(), targets.end(), cumulative[b + 1]) - targets.begin();
+                if (first == last) continue;
+                size_t shot = first, nonzero = b * block;
+                double acc = cumulative[b];
+                for (size_t i = b * block; i < (b + 1) * block && shot < last; ++i) {
+                    double p = std::norm(amplitudes[i]);
+                    if (p == 0.0) continue;
+                    nonzero = i;
+                    acc += p;
+                    while (shot < last && targets[shot] < acc) outcomes[shot++] = i;
+                }
+                // Rounding can leave the last few targets just past the block's running sum
+                while (shot < last) outcomes[shot++] = nonzero;
+            }
+        });
+        return outcomes;
+    }
+
+    // Measure the given qubits and collapse the state onto the observed outcome.
+    // Bit j of the result is the value read from measured[j]. One shot of the full
+    // distribution gives the joint outcome of the subset; the amplitudes that disagree
+    // with it are then zeroed and the rest renormalized.
+    uint64_t measure(const std::vector<int>& measured, uint64_t seed) {
+        size_t mask = 0;
+        for (int q : measured) {
+            check_qubit(q);
+            mask |= size_t(1) << q;
+        }
+        const size_t observed = sample(1, seed)[0] & mask;
+        project(mask, observed);
+
+        uint64_t result = 0;
+        for (size_t j = 0; j < measured.size(); ++j) {
+            result |= uint64_t((observed >> measured[j]) & 1) << j;
+        }
+        return result;
+    }
+
+    // Collapse onto the basis states i with (i & mask) == observed: the other amplitudes are
+    // zeroed and the rest renormalized (e.g. to replay a recorded measurement outcome).
+    // Throws invalid_argument, leaving the state untouched, if the outcome's probability is
+    // below rounding noise (epsilon^2 of a unit-norm state), since it cannot be renormalized.
+    void project(size_t mask, size_t observed) {
+        const size_t chunk = std::min(kSampleBlock, amplitudes.size());
+        std::vector<double> kept(amplitudes.size() / chunk, 0.0);
+        ThreadPool::instance().parallel_for(kept.size(), kMinPairsPerWorker / chunk + 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                double sum = 0.0;
+                for (size_t i = c * chunk; i < (c + 1) * chunk; ++i) {
+                    if ((i & mask) == observed) sum += std::norm(amplitudes[i]);
+                }
+                kept[c] = sum;
+            }
+        });
+        const double probability = std::accumulate(kept.begin(), kept.end(), 0.0);
+        const double epsilon = std::numeric_limits<Real>::epsilon();
+        if (!(probability > epsilon * epsilon)) {
+            throw std::invalid_argument("Measurement outcome has zero probability.");
+        }
+        const Real scale = Real(1.0 / std::sqrt(probability));
+        ThreadPool::instance().parallel_for(amplitudes.size(), kMinPairsPerWorker, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                amplitudes[i] = (i & mask) == observed ? amplitudes[i] * scale : Value(0);
+            }
+        });
+    }
+
+private:
+    BasicStateVector() : qubits(0) {}
+
+    static bool write_all(int fd, const char* bytes, size_t length) {
+        while (length > 0) {
+            ssize_t written = write(fd, bytes, std::min(length, kCheckpointChunk));
+            if (written <= 0) return false;
+            bytes += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    static bool read_all(int fd, char* bytes, size_t length) {
+        while (length > 0) {
+            ssize_t got = read(fd, bytes, std::min(length, kCheckpointChunk));
+            if (got <= 0) return false;
+            bytes += got;
+            length -= got;
+        }
+        return true;
+    }
+
+    void check_qubit(int qubit) const {
+        if (qubit < 0 || qubit >= qubits) {
+            throw std::out_of_range("Qubit index out of range.");
+        }
+    }
+
+    // Indices whose fixed_bits equal the matching bits of set_mask, grouped into runs of
+    // run_length indices `step` apart. Indices are numbered by their free bits; consecutive
+    // numbers below the lowest fixed bit are contiguous in memory (or every other amplitude
+    // when bit 0 is fixed).
+    struct RunLayout {
+        std::vector<int> fixed_bits; // Sorted
+        size_t set_mask, step, run_length, num_runs;
+
+        size_t first_index(size_t run) const {
+            // Spread the run's first index number over the free bits, then set the fixed bits
+            size_t i0 = run * run_length;
+            for (int bit : fixed_bits) {
+                i0 = ((i0 >> bit) << (bit + 1)) | (i0 & ((size_t(1) << bit) - 1));
+            }
+            return i0 | set_mask;
+        }
+    };
+
+    RunLayout run_layout(std::vector<int> fixed_bits, size_t set_mask) const {
+        std::sort(fixed_bits.begin(), fixed_bits.end());
+        const size_t num_indices = amplitudes.size() >> fixed_bits.size();
+
+        size_t step = 1, run_length;
+        if (fixed_bits[0] > 0) {
+            run_length = size_t(1) << fixed_bits[0];
+        } else {
+            step = 2;
+            int next_fixed = fixed_bits.size() > 1 ? fixed_bits[1] : qubits;
+            run_length = size_t(1) << (next_fixed - 1);
+        }
+        run_length = std::min({run_length, kMaxRunLength, num_indices});
+        return {std::move(fixed_bits), set_mask, step, run_length, num_indices / run_length};
+    }
+
+    // Call visit(first, step, count) on every run of the layout, covering first[0],
+    // first[step], ... first[(count - 1) * step]. Runs are split across the thread pool.
+    template <typename Visitor>
+    void for_each_run(std::vector<int> fixed_bits, size_t set_mask, Visitor visit) {
+        const RunLayout layout = run_layout(std::move(fixed_bits), set_mask);
+        Value* amp = amplitudes.data();
+        ThreadPool::instance().parallel_for(layout.num_runs, kMinPairsPerWorker / layout.run_length + 1,
+                                            [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                visit(amp + layout.first_index(r), layout.step, layout.run_length);
+            }
+        });
+    }
+
+    // Sum of visit(first_index, step, count) over every run. Runs are summed in fixed groups,
+    // then the groups in order, so the result does not depend on the number of threads.
+    template <typename Visitor>
+    std::complex<double> reduce_runs(std::vector<int> fixed_bits, size_t set_mask, Visitor visit) const {
+        const RunLayout layout = run_layout(std::move(fixed_bits), set_mask);
+        const size_t group = std::max<size_t>(1, kSampleBlock / layout.run_length);
+        std::vector<std::complex<double>> partial((layout.num_runs + group - 1) / group);
+        ThreadPool::instance().parallel_for(partial.size(), kMinPairsPerWorker / (group * layout.run_length) + 1,
+                                            [&](size_t begin, size_t end) {
+            for (size_t g = begin; g < end; ++g) {
+                std::complex<double> sum = 0.0;
+                for (size_t r = g * group; r < std::min(layout.num_runs, (g + 1) * group); ++r) {
+                    sum += visit(layout.first_index(r), layout.step, layout.run_length);
+                }
+                partial[g] = sum;
+            }
+        });
+        return std::accumulate(partial.begin(), partial.end(), std::complex<double>(0.0));
+    }
+
+    // Apply a gate to every (i0, i1 = i0 | stride) pair whose control bits are all set,
+    // dispatching on the gate's structure:
+    // - diagonal gates only scale amplitudes, and skip the target-0 half when m00 == 1
+    // - anti-diagonal gates exchange the pair, as a plain swap when both entries are 1
+    // - general gates use the dense kernels (SIMD where the run layout allows it)
+    void apply_pairs(const Gate& gate, int target, size_t control_mask) {
+        check_qubit(target);
+        const size_t stride = size_t(1) << target;
+        std::vector<int> fixed_bits = {target};
+        for (int q = 0; q < qubits; ++q) {
+            if ((control_mask >> q) & 1) fixed_bits.push_back(q);
+        }
+        const Amplitude one(1.0, 0.0);
+
+        switch (classify(gate)) {
+        case GateKind::Diagonal:
+            if (gate.m[0] == one) {
+                if (gate.m[3] == one) return; // Identity
+                for_each_run(fixed_bits, control_mask | stride, [&](Value* first, size_t step, size_t count) {
+                    scale_run(first, step, count, Value(gate.m[3]));
+                });
+            } else {
+                for_each_run(fixed_bits, control_mask, [&](Value* first, size_t step, size_t count) {
+                    scale_run(first, step, count, Value(gate.m[0]));
+                    scale_run(first + stride, step, count, Value(gate.m[3]));
+                });
+            }
+            return;
+        case GateKind::AntiDiagonal:
+            for_each_run(fixed_bits, control_mask, [&](Value* first, size_t step, size_t count) {
+                const Value m01(gate.m[1]), m10(gate.m[2]);
+                if (gate.m[1] == one && gate.m[2] == one) {
+                    for (size_t k = 0; k < count * step; k += step) {
+                        std::swap(first[k], first[k + stride]);
+                    }
+                    return;
+                }
+                for (size_t k = 0; k < count * step; k += step) {
+                    Value a0 = first[k];
+                    first[k] = m01 * first[k + stride];
+                    first[k + stride] = m10 * a0;
+                }
+            });
+            return;
+        case GateKind::General:
+            break;
+        }
+
+        RunKernel kernel = scalar_run;
+#if defined(__AVX2__)
+        bool contiguous = std::all_of(fixed_bits.begin(), fixed_bits.end(), [](int bit) { return bit > 0; });
+        if (contiguous) {
+            kernel = simd_run;
+        } else if (target == 0) {
+            kernel = low_pair_run;
+        }
+#endif
+        for_each_run(fixed_bits, control_mask, [&](Value* first, size_t step, size_t count) {
+            kernel(first, stride, step, count, gate);
+        });
+    }
+
+    // Multiply `count` amplitudes, `step` apart, by c (written out so it vectorizes)
+    static void scale_run(Value* first, size_t step, size_t count, Value c) {
+        Real* p = reinterpret_cast<Real*>(first);
+        const Real cr = c.real(), ci = c.imag();
+        for (size_t k = 0; k < 2 * count * step; k += 2 * step) {
+            Real re = p[k], im = p[k + 1];
+            p[k] = re * cr - im * ci;
+            p[k + 1] = re * ci + im * cr;
+        }
+    }
+
+    static constexpr double kDriftTolerance = std::is_same<Real, float>::value ? 1e-5 : 1e-12;
+    // Amplitudes per entry of the cumulative table used by sample()
+    static constexpr size_t kSampleBlock = size_t(1) << 12;
+    // Runs are capped so that a single high target still spreads over all workers
+    static constexpr size_t kMaxRunLength = 4096;
+    // Below this many pairs per worker the pool is not worth waking
+    static constexpr size_t kMinPairsPerWorker = size_t(1) << 14;
+
+    // Updates `count` pairs (first[k * step], first[k * step + stride])
+    using RunKernel = void (*)(Value*, size_t, size_t, size_t, const Gate&);
+
+    // Complex products are written out on real parts: std::complex operator* checks for
+    // infinities and NaNs through a library call, which dominates a loop this simple
+    static void scalar_run(Value* first, size_t stride, size_t step, size_t count, const Gate& g) {
+        const Real r00 = g.m[0].real(), i00 = g.m[0].imag(), r01 = g.m[1].real(), i01 = g.m[1].imag();
+        const Real r10 = g.m[2].real(), i10 = g.m[2].imag(), r11 = g.m[3].real(), i11 = g.m[3].imag();
+        Real* p0 = reinterpret_cast<Real*>(first);
+        Real* p1 = reinterpret_cast<Real*>(first + stride);
+        for (size_t k = 0; k < 2 * count * step; k += 2 * step) {
+            Real a0r = p0[k], a0i = p0[k + 1], a1r = p1[k], a1i = p1[k + 1];
+            p0[k] = r00 * a0r - i00 * a0i + r01 * a1r - i01 * a1i;
+            p0[k + 1] = r00 * a0i + i00 * a0r + r01 * a1i + i01 * a1r;
+            p1[k] = r10 * a0r - i10 * a0i + r11 * a1r - i11 * a1i;
+            p1[k + 1] = r10 * a0i + i10 * a0r + r11 * a1i + i11 * a1r;
+        }
+    }
+
+#if defined(__AVX2__)
+    // Complex product of a vector of interleaved (re, im) values with coefficients whose real
+    // and imaginary parts are given duplicated per lane
+    static __m256d complex_mul(__m256d c_re, __m256d c_im, __m256d v) {
+        __m256d swapped = _mm256_permute_pd(v, 0b0101);
+#if defined(__FMA__)
+        return _mm256_fmaddsub_pd(c_re, v, _mm256_mul_pd(c_im, swapped));
+#else
+        return _mm256_addsub_pd(_mm256_mul_pd(c_re, v), _mm256_mul_pd(c_im, swapped));
+#endif
+    }
+
+    static __m256 complex_mul(__m256 c_re, __m256 c_im, __m256 v) {
+        __m256 swapped = _mm256_permute_ps(v, 0xB1);
+#if defined(__FMA__)
+        return _mm256_fmaddsub_ps(c_re, v, _mm256_mul_ps(c_im, swapped));
+#else
+        return _mm256_addsub_ps(_mm256_mul_ps(c_re, v), _mm256_mul_ps(c_im, swapped));
+#endif
+    }
+
+    static __m128 complex_mul(__m128 c_re, __m128 c_im, __m128 v) {
+        __m128 swapped = _mm_permute_ps(v, 0xB1);
+#if defined(__FMA__)
+        return _mm_fmaddsub_ps(c_re, v, _mm_mul_ps(c_im, swapped));
+#else
+        return _mm_addsub_ps(_mm_mul_ps(c_re, v), _mm_mul_ps(c_im, swapped));
+#endif
+    }
+
+    // Target qubit 0: pairs are adjacent, so run through the amplitudes linearly
+    static void low_pair_run(Value* first, size_t, size_t, size_t count, const Gate& g) {
+        size_t k = low_pair_block(reinterpret_cast<Real*>(first), count, g);
+        scalar_run(first + 2 * k, 1, 2, count - k, g);
+    }
+
+    // Double: each pair (a0, a1) fills one register
+    static size_t low_pair_block(double* p, size_t count, const Gate& g) {
+        // Matrix columns (m00, m10) and (m01, m11), split into duplicated real/imag parts
+        __m256d col0_re = _mm256_setr_pd(g.m[0].real(), g.m[0].real(), g.m[2].real(), g.m[2].real());
+        __m256d col0_im = _mm256_setr_pd(g.m[0].imag(), g.m[0].imag(), g.m[2].imag(), g.m[2].imag());
+        __m256d col1_re = _mm256_setr_pd(g.m[1].real(), g.m[1].real(), g.m[3].real(), g.m[3].real());
+        __m256d col1_im = _mm256_setr_pd(g.m[1].imag(), g.m[1].imag(), g.m[3].imag(), g.m[3].imag());
+        for (size_t k = 0; k < count; ++k, p += 4) {
+            __m256d v = _mm256_loadu_pd(p);
+            __m256d lo = _mm256_permute2f128_pd(v, v, 0x00); // (a0, a0)
+            __m256d hi = _mm256_permute2f128_pd(v, v, 0x11); // (a1, a1)
+            _mm256_storeu_pd(p, _mm256_add_pd(complex_mul(col0_re, col0_im, lo), complex_mul(col1_re, col1_im, hi)));
+        }
+        return count;
+    }
+
+    // Float: two pairs (a0, a1, b0, b1) per register; each complex float is one 64-bit lane,
+    // so the double permute broadcasts whole amplitudes
+    static size_t low_pair_block(float* p, size_t count, const Gate& g) {
+        float r0 = g.m[0].real(), i0 = g.m[0].imag(), r1 = g.m[1].real(), i1 = g.m[1].imag();
+        float r2 = g.m[2].real(), i2 = g.m[2].imag(), r3 = g.m[3].real(), i3 = g.m[3].imag();
+        __m256 col0_re = _mm256_setr_ps(r0, r0, r2, r2, r0, r0, r2, r2);
+        __m256 col0_im = _mm256_setr_ps(i0, i0, i2, i2, i0, i0, i2, i2);
+        __m256 col1_re = _mm256_setr_ps(r1, r1, r3, r3, r1, r1, r3, r3);
+        __m256 col1_im = _mm256_setr_ps(i1, i1, i3, i3, i1, i1, i3, i3);
+        size_t k = 0;
+        for (; k + 2 <= count; k += 2, p += 8) {
+            __m256d v = _mm256_castps_pd(_mm256_loadu_ps(p));
+            __m256 lo = _mm256_castpd_ps(_mm256_permute_pd(v, 0b0000)); // (a0, a0, b0, b0)
+            __m256 hi = _mm256_castpd_ps(_mm256_permute_pd(v, 0b1111)); // (a1, a1, b1, b1)
+            _mm256_storeu_ps(p, _mm256_add_ps(complex_mul(col0_re, col0_im, lo), complex_mul(col1_re, col1_im, hi)));
+        }
+        return k;
+    }
+
+    // Contiguous run: vector blocks first, scalar for any remainder
+    static void simd_run(Value* first, size_t stride, size_t, size_t count, const Gate& g) {
+        size_t k = simd_block(reinterpret_cast<Real*>(first), reinterpret_cast<Real*>(first + stride), count, g);
+        scalar_run(first + k, stride, 1, count - k, g);
+    }
+
+    // Double: 4 pairs per step with AVX-512, then 2 with AVX2
+    static size_t simd_block(double* p0, double* p1, size_t count, const Gate& g) {
+        size_t k = 0;
+#if defined(__AVX512F__)
+        {
+            __m512d re[4], im[4];
+            for (int j = 0; j < 4; ++j) {
+                re[j] = _mm512_set1_pd(g.m[j].real());
+                im[j] = _mm512_set1_pd(g.m[j].imag());
+            }
+            for (; k + 4 <= count; k += 4) {
+                __m512d a0 = _mm512_loadu_pd(p0 + 2 * k), a1 = _mm512_loadu_pd(p1 + 2 * k);
+                _mm512_storeu_pd(p0 + 2 * k, _mm512_add_pd(complex_mul(re[0], im[0], a0), complex_mul(re[1], im[1], a1)));
+                _mm512_storeu_pd(p1 + 2 * k, _mm512_add_pd(complex_mul(re[2], im[2], a0), complex_mul(re[3], im[3], a1)));
+            }
+        }
+#endif
+        __m256d re[4], im[4];
+        for (int j = 0; j < 4; ++j) {
+            re[j] = _mm256_set1_pd(g.m[j].real());
+            im[j] = _mm256_set1_pd(g.m[j].imag());
+        }
+        for (; k + 2 <= count; k += 2) {
+            __m256d a0 = _mm256_loadu_pd(p0 + 2 * k), a1 = _mm256_loadu_pd(p1 + 2 * k);
+            _mm256_storeu_pd(p0 + 2 * k, _mm256_add_pd(complex_mul(re[0], im[0], a0), complex_mul(re[1], im[1], a1)));
+            _mm256_storeu_pd(p1 + 2 * k, _mm256_add_pd(complex_mul(re[2], im[2], a0), complex_mul(re[3], im[3], a1)));
+        }
+        return k;
+    }
+
+    // Float: 8 pairs per step with AVX-512, then 4 with AVX2, then 2 with SSE (target 1 runs
+    // are only 2 amplitudes long)
+    static size_t simd_block(float* p0, float* p1, size_t count, const Gate& g) {
+        size_t k = 0;
+#if defined(__AVX512F__)
+        {
+            __m512 re[4], im[4];
+            for (int j = 0; j < 4; ++j) {
+                re[j] = _mm512_set1_ps(g.m[j].real());
+                im[j] = _mm512_set1_ps(g.m[j].imag());
+            }
+            for (; k + 8 <= count; k += 8) {
+                __m512 a0 = _mm512_loadu_ps(p0 + 2 * k), a1 = _mm512_loadu_ps(p1 + 2 * k);
+                _mm512_storeu_ps(p0 + 2 * k, _mm512_add_ps(complex_mul(re[0], im[0], a0), complex_mul(re[1], im[1], a1)));
+                _mm512_storeu_ps(p1 + 2 * k, _mm512_add_ps(complex_mul(re[2], im[2], a0), complex_mul(re[3], im[3], a1)));
+            }
+        }
+#endif
+        {
+            __m256 re[4], im[4];
+            for (int j = 0; j < 4; ++j) {
+                re[j] = _mm256_set1_ps(g.m[j].real());
+                im[j] = _mm256_set1_ps(g.m[j].imag());
+            }
+            for (; k + 4 <= count; k += 4) {
+                __m256 a0 = _mm256_loadu_ps(p0 + 2 * k), a1 = _mm256_loadu_ps(p1 + 2 * k);
+                _mm256_storeu_ps(p0 + 2 * k, _mm256_add_ps(complex_mul(re[0], im[0], a0), complex_mul(re[1], im[1], a1)));
+                _mm256_storeu_ps(p1 + 2 * k, _mm256_add_ps(complex_mul(re[2], im[2], a0), complex_mul(re[3], im[3], a1)));
+            }
+        }
+        __m128 re[4], im[4];
+        for (int j = 0; j < 4; ++j) {
+            re[j] = _mm_set1_ps(g.m[j].real());
+            im[j] = _mm_set1_ps(g.m[j].imag());
+        }
+        for (; k + 2 <= count; k += 2) {
+            __m128 a0 = _mm_loadu_ps(p0 + 2 * k), a1 = _mm_loadu_ps(p1 + 2 * k);
+            _mm_storeu_ps(p0 + 2 * k, _mm_add_ps(complex_mul(re[0], im[0], a0), complex_mul(re[1], im[1], a1)));
+            _mm_storeu_ps(p1 + 2 * k, _mm_add_ps(complex_mul(re[2], im[2], a0), complex_mul(re[3], im[3], a1)));
+        }
+        return k;
+    }
+#endif
+
+#if defined(__AVX512F__)
+    static __m512d complex_mul(__m512d c_re, __m512d c_im, __m512d v) {
+        __m512d swapped = _mm512_shuffle_pd(v, v, 0x55);
+        return _mm512_fmaddsub_pd(c_re, v, _mm512_mul_pd(c_im, swapped));
+    }
+
+    static __m512 complex_mul(__m512 c_re, __m512 c_im, __m512 v) {
+        __m512 swapped = _mm512_shuffle_ps(v, v, 0xB1);
+        return _mm512_fmaddsub_ps(c_re, v, _mm512_mul_ps(c_im, swapped));
+    }
+#endif
+
+    int qubits;
+    AmplitudeBuffer<Value> amplitudes;
+};
+
+using StateVector = BasicStateVector<double>;
+using StateVectorFloat = BasicStateVector<float>;
+
+// One circuit step: a single-qubit gate on target, controlled by `control` when it is >= 0
+// A parameterized step (parameter >= 0) is a rotation about `axis` by parameters[parameter];
+// its gate is only filled in by Circuit::bind.
+struct Operation {
+    Gate gate;
+    int target;
+    int control = -1;
+    int parameter = -1;
+    Rotation axis = Rotation::Z;
+};
+
+// Ordered list of gate operations on a fixed number of qubits
+class Circuit {
+public:
+    explicit Circuit(int num_qubits) : qubits(num_qubits) {}
+
+    int num_qubits() const { return qubits; }
+    const std::vector<Operation>& operations() const { return ops; }
+
+    Circuit& add(const Gate& gate, int target) {
+        ops.push_back({gate, target, -1});
+        return *this;
+    }
+
+    Circuit& add_controlled(const Gate& gate, int control, int target) {
+        ops.push_back({gate, target, control});
+        return *this;
+    }
+
+    Circuit& add_cnot(int control, int target) { return add_controlled(pauli_x_gate(), control, target); }
+
+    // Rotation about `axis` by parameters[parameter], optionally controlled
+    Circuit& add_parameterized(Rotation axis, int parameter, int target, int control = -1) {
+        ops.push_back({rotation_gate(axis, 0.0), target, control, parameter, axis});
+        return *this;
+    }
+
+    // Length of the parameter vectors this circuit expects
+    size_t num_parameters() const {
+        int highest = -1;
+        for (const auto& op : ops) highest = std::max(highest, op.parameter);
+        return size_t(highest + 1);
+    }
+
+    // Index of the first parameterized operation (the size of the circuit if there is none);
+    // everything before it is the same for every parameter vector
+    size_t first_parameterized() const {
+        for (size_t i = 0; i < ops.size(); ++i) {
+            if (ops[i].parameter >= 0) return i;
+        }
+        return ops.size();
+    }
+
+    // Concrete copy of operations [first, end) with every rotation evaluated at `parameters`
+    Circuit bind(const std::vector<double>& parameters, size_t first = 0) const {
+        Circuit out(qubits);
+        for (size_t i = first; i < ops.size(); ++i) {
+            Operation op = ops[i];
+            if (op.parameter >= 0) {
+                if (size_t(op.parameter) >= parameters.size()) {
+                    throw std::out_of_range("Parameter vector is too short for the circuit.");
+                }
+                op.gate = rotation_gate(op.axis, parameters[op.parameter]);
+                op.parameter = -1;
+            }
+            out.ops.push_back(op);
+        }
+        return out;
+    }
+
+    // Copy of the circuit in which every run of single-qubit gates on the same qubit, with no
+    // other operation on that qubit in between, is multiplied into one 2x2 gate. Gates on other
+    // qubits commute with the run, so the fused circuit is equivalent and makes one pass over
+    // the state per run instead of one per gate.
+    Circuit fused() const {
+        Circuit out(qubits);
+        std::vector<long> open_run(qubits, -1); // Index in out of the fusable gate on each qubit
+        for (const auto& op : ops) {
+            if (op.control >= 0 || op.parameter >= 0) {
+                if (op.control >= 0) open_run[op.control] = -1;
+                open_run[op.target] = -1;
+                out.ops.push_back(op);
+            } else if (open_run[op.target] >= 0) {
+                Gate& merged = out.ops[open_run[op.target]].gate;
+                merged = op.gate * merged;
+            } else {
+                open_run[op.target] = out.ops.size();
+                out.ops.push_back(op);
+            }
+        }
+        return out;
+    }
+
+    // Apply every operation to a simulator (anything with apply_gate / apply_controlled_gate)
+    template <typename Simulator>
+    void run(Simulator& simulator) const {
+        run(simulator, 0, ops.size());
+    }
+
+    // Apply operations [first, last), e.g. to resume from a checkpointed position
+    template <typename Simulator>
+    void run(Simulator& simulator, size_t first, size_t last) const {
+        last = std::min(last, ops.size());
+        for (size_t i = first; i < last; ++i) {
+            const Operation& op = ops[i];
+            if (op.parameter >= 0) {
+                throw std::logic_error("Bind the circuit's parameters before running it.");
+            }
+            if (op.control >= 0) {
+                simulator.apply_controlled_gate(op.gate, op.control, op.target);
+            } else {
+                simulator.apply_gate(op.gate, op.target);
+            }
+        }
+    }
+
+private:
+    int qubits;
+    std::vector<Operation> ops;
+};
+
+// Run `circuit` on `state` from operation `position`, saving a checkpoint to `path` after
+// every `interval` operations and at the end. To resume after preemption:
+//   uint64_t position;
+//   StateVector state = StateVector::load_checkpoint(path, &position);
+//   run_checkpointed(circuit, state, path, interval, position);
+template <typename Real>
+void run_checkpointed(const Circuit& circuit, BasicStateVector<Real>& state, const std::string& path,
+                      size_t interval, uint64_t position = 0) {
+    const size_t total = circuit.operations().size();
+    interval = std::max<size_t>(interval, 1);
+    while (position < total) {
+        size_t next = std::min<size_t>(position + interval, total);
+        circuit.run(state, position, next);
+        position = next;
+        state.save_checkpoint(path, position);
+    }
+}
+
+// Hermitian observable as a real-weighted sum of Pauli strings. A term carries X on the bits
+// of x_mask, Z on the bits of z_mask and Y where both are set, so it maps |j> to
+// i^popcount(x & z) * (-1)^popcount(j & z) * |j ^ x>.
+struct PauliTerm {
+    double coefficient;
+    uint64_t x_mask = 0;
+    uint64_t z_mask = 0;
+};
+
+class PauliSum {
+public:
+    // Add coefficient * (ops[0] on qubit 0) (ops[1] on qubit 1) ..., each op one of I, X, Y, Z
+    PauliSum& add(double coefficient, const std::string& ops) {
+        if (ops.size() > 64) {
+            throw std::invalid_argument("Pauli strings may act on at most 64 qubits.");
+        }
+        PauliTerm term{coefficient, 0, 0};
+        for (size_t q = 0; q < ops.size(); ++q) {
+            uint64_t bit = uint64_t(1) << q;
+            switch (ops[q]) {
+            case 'I': break;
+            case 'X': term.x_mask |= bit; break;
+            case 'Y': term.x_mask |= bit; term.z_mask |= bit; break;
+            case 'Z': term.z_mask |= bit; break;
+            default: throw std::invalid_argument("Pauli strings may only contain I, X, Y and Z.");
+            }
+        }
+        terms.push_back(term);
+        return *this;
+    }
+
+    const std::vector<PauliTerm>& pauli_terms() const { return terms; }
+
+    // Throws out_of_range unless every term acts only on qubits of a state with `size` amplitudes
+    void check_masks(size_t size) const {
+        for (const auto& term : terms) {
+            if (term.x_mask >= size || term.z_mask >= size) {
+                throw std::out_of_range("Pauli string acts on more qubits than the state has.");
+            }
+        }
+    }
+
+    // <state|O|state>, one read-only pass per term; no product state is allocated
+    template <typename Real>
+    double expectation(const BasicStateVector<Real>& state) const {
+        check_masks(state.size());
+        const auto* amp = state.data();
+        const size_t chunk = std::min(kChunk, state.size());
+        std::vector<double> partial(state.size() / chunk, 0.0);
+        ThreadPool::instance().parallel_for(partial.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                double sum = 0.0;
+                for (const auto& term : terms) {
+                    // <j ^ x| P |j> = i^popcount(x & z) (-1)^popcount(j & z), so the term is the
+                    // real part of i^popcount(x & z) * sum_j (-1)^popcount(j & z) conj(a[j ^ x]) a[j]
+                    std::complex<double> acc = 0.0;
+                    for (size_t j = c * chunk; j < (c + 1) * chunk; ++j) {
+                        std::complex<double> v = std::conj(std::complex<double>(amp[j ^ term.x_mask])) *
+                                                 std::complex<double>(amp[j]);
+                        acc += (__builtin_popcountll(j & term.z_mask) & 1) ? -v : v;
+                    }
+                    sum += term.coefficient * (phase(term) * acc).real();
+                }
+                partial[c] = sum;
+            }
+        });
+        return std::accumulate(partial.begin(), partial.end(), 0.0);
+    }
+
+    // out = O |state|; out must have the same number of qubits
+    template <typename Real>
+    void apply(const BasicStateVector<Real>& state, BasicStateVector<Real>& out) const {
+        using Value = typename BasicStateVector<Real>::Value;
+        check_masks(state.size());
+        if (out.size() != state.size()) {
+            throw std::invalid_argument("Output state must have the same number of qubits.");
+        }
+        const Value* in = state.data();
+        Value* result = out.data();
+        ThreadPool::instance().parallel_for(state.size(), kChunk, [&](size_t begin, size_t end) {
+            for (size_t j = begin; j < end; ++j) {
+                // Row j of the term is its column j ^ x
+                std::complex<double> sum = 0.0;
+                for (const auto& term : terms) {
+                    size_t source = j ^ term.x_mask;
+                    double sign = (__builtin_popcountll(source & term.z_mask) & 1) ? -1.0 : 1.0;
+                    sum += term.coefficient * sign * phase(term) * std::complex<double>(in[source]);
+                }
+                result[j] = Value(sum);
+            }
+        });
+    }
+
+private:
+    static std::complex<double> phase(const PauliTerm& term) {
+        static const std::complex<double> powers[4] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+        return powers[__builtin_popcountll(term.x_mask & term.z_mask) & 3];
+    }
+
+    static constexpr size_t kChunk = size_t(1) << 12;
+    std::vector<PauliTerm> terms;
+};
+
+// Up-front validation of a sweep observable; only PauliSum has anything to check
+template <typename Observable>
+void check_observable(const Observable&, size_t) {}
+void check_observable(const PauliSum& observable, size_t size) { observable.check_masks(size); }
+
+// Expectation of `observable` (anything with expectation(state)) after running `circuit`
+// from |0...0> with each parameter vector. The operations before the first parameterized
+// gate are run once into a cached prefix state; each evaluation copies that state into a
+// per-worker buffer and runs only the bound, fused remainder. Parameter vectors are spread
+// over the thread pool (gate kernels inside an evaluation then run on their worker), so
+// memory use is one state per worker plus the prefix.
+template <typename Real = double, typename Observable>
+std::vector<double> sweep(const Circuit& circuit, const std::vector<std::vector<double>>& parameter_sets,
+                          const Observable& observable) {
+    // Reject bad input before any work is spread over the pool
+    const size_t num_parameters = circuit.num_parameters();
+    for (const auto& parameters : parameter_sets) {
+        if (parameters.size() < num_parameters) {
+            throw std::out_of_range("Parameter vector is too short for the circuit.");
+        }
+    }
+    check_observable(observable, size_t(1) << circuit.num_qubits());
+
+    const size_t prefix_end = circuit.first_parameterized();
+    BasicStateVector<Real> prefix(circuit.num_qubits());
+    circuit.run(prefix, 0, prefix_end);
+
+    std::vector<double> results(parameter_sets.size());
+    ThreadPool::instance().parallel_for(parameter_sets.size(), 1, [&](size_t begin, size_t end) {
+        BasicStateVector<Real> work(circuit.num_qubits());
+        for (size_t i = begin; i < end; ++i) {
+            std::copy(prefix.data(), prefix.data() + prefix.size(), work.data());
+            circuit.bind(parameter_sets[i], prefix_end).fused().run(work);
+            results[i] = observable.expectation(work);
+        }
+    });
+    return results;
+}
+
+// d/dtheta of rotation_gate(axis, theta): -i/2 P R(theta) for the Pauli rotations,
+// diag(0, i e^(i theta)) for the phase gate
+Gate rotation_derivative(Rotation axis, double angle) {
+    if (axis == Rotation::Phase) {
+        return {{0.0, 0.0, 0.0, std::polar(1.0, angle) * Amplitude(0, 1)}};
+    }
+    Gate pauli = axis == Rotation::X ? pauli_x_gate() : axis == Rotation::Y ? pauli_y_gate() : pauli_z_gate();
+    Gate d = pauli * rotation_gate(axis, angle);
+    for (auto& v : d.m) v *= Amplitude(0, -0.5);
+    return d;
+}
+
+// Expectation value and its gradient with respect to every circuit parameter
+struct GradientResult {
+    double value = 0.0;
+    std::vector<double> gradient;
+};
+
+// Adjoint-method gradient of <psi(theta)|O|psi(theta)> for a Hermitian observable with
+// apply(state, out) and a circuit run from |0...0>. One forward run gives psi and
+// lambda = O psi; the backward sweep then uncomputes both with U_i^dagger, one operation at a
+// time, and each parameterized U_i adds 2 Re <lambda_i| dU_i/dtheta |psi_(i-1)> to its
+// parameter. That is about three circuit evaluations for any number of parameters, using
+// two state vectors. The sweep stops at the first parameterized operation.
+template <typename Real = double, typename Observable>
+GradientResult adjoint_gradient(const Circuit& circuit, const std::vector<double>& parameters,
+                                const Observable& observable) {
+    const std::vector<Operation>& ops = circuit.operations();
+    const Circuit bound = circuit.bind(parameters);
+    BasicStateVector<Real> psi(circuit.num_qubits()), lambda(circuit.num_qubits());
+    bound.run(psi);
+    observable.apply(psi, lambda);
+
+    GradientResult result;
+    result.value = psi.inner_product(lambda).real();
+    result.gradient.assign(circuit.num_parameters(), 0.0);
+
+    const size_t first = circuit.first_parameterized();
+    for (size_t i = ops.size(); i-- > first;) {
+        const Operation& op = bound.operations()[i];
+        const Gate inverse = adjoint(op.gate);
+        if (op.control >= 0) {
+            psi.apply_controlled_gate(inverse, op.control, op.target);
+        } else {
+            psi.apply_gate(inverse, op.target);
+        }
+        if (ops[i].parameter >= 0) {
+            Gate derivative = rotation_derivative(ops[i].axis, parameters[ops[i].parameter]);
+            result.gradient[ops[i].parameter] +=
+                2.0 * lambda.gate_matrix_element(derivative, op.target, op.control, psi).real();
+        }
+        if (i == first) break; // psi and lambda are no longer needed
+        if (op.control >= 0) {
+            lambda.apply_controlled_gate(inverse, op.control, op.target);
+        } else {
+            lambda.apply_gate(inverse, op.target);
+        }
+    }
+    return result;
+}
+
+// Stabilizer tableau (Aaronson-Gottesman) for Clifford circuits: rows 0..n-1 are the
+// destabilizers, rows n..2n-1 the stabilizers and row 2n is scratch. Each row stores its X
+// and Z parts as packed bits (qubit q is bit q % 64 of word q / 64) plus a sign bit, so
+// multiplying two rows is a word-wide XOR. Gates cost O(n) and a measurement O(n^2 / 64),
+// which handles thousands of qubits.
+class StabilizerTableau {
+public:
+    explicit StabilizerTableau(int num_qubits, uint64_t seed = std::random_device{}())
+        : n(num_qubits), words((num_qubits + 63) / 64), xs((2 * n + 1) * words, 0), zs((2 * n + 1) * words, 0),
+          signs(2 * n + 1, 0), gen(seed) {
+        if (num_qubits < 1) {
+            throw std::invalid_argument("StabilizerTableau needs at least one qubit.");
+        }
+        for (size_t q = 0; q < n; ++q) {
+            xs[q * words + q / 64] |= bit(q);       // Destabilizer X_q
+            zs[(n + q) * words + q / 64] |= bit(q); // Stabilizer Z_q: the state is |0...0>
+        }
+    }
+
+    int num_qubits() const { return int(n); }
+
+    void h(int q) {
+        for_rows(q, [&](uint64_t& x, uint64_t& z, uint8_t& sign, uint64_t b) {
+            sign ^= (x & z & b) != 0;
+            uint64_t flip = (x ^ z) & b;
+            x ^= flip;
+            z ^= flip;
+        });
+    }
+
+    void s(int q) {
+        for_rows(q, [&](uint64_t& x, uint64_t& z, uint8_t& sign, uint64_t b) {
+            sign ^= (x & z & b) != 0;
+            z ^= x & b;
+        });
+    }
+
+    void x(int q) {
+        for_rows(q, [&](uint64_t&, uint64_t& z, uint8_t& sign, uint64_t b) { sign ^= (z & b) != 0; });
+    }
+
+    void z(int q) {
+        for_rows(q, [&](uint64_t& x, uint64_t&, uint8_t& sign, uint64_t b) { sign ^= (x & b) != 0; });
+    }
+
+    void y(int q) {
+        for_rows(q, [&](uint64_t& x, uint64_t& z, uint8_t& sign, uint64_t b) { sign ^= ((x ^ z) & b) != 0; });
+    }
+
+    void cnot(int control, int target) {
+        check(control);
+        check(target);
+        if (control == target) {
+            throw std::invalid_argument("Control and target qubits must differ.");
+        }
+        const size_t wc = control / 64, wt = target / 64;
+        const uint64_t bc = bit(control), bt = bit(target);
+        for (size_t r = 0; r < 2 * n; ++r) {
+            uint64_t* x = &xs[r * words];
+            uint64_t* z = &zs[r * words];
+            bool xc = x[wc] & bc, zc = z[wc] & bc, xt = x[wt] & bt, zt = z[wt] & bt;
+            signs[r] ^= xc && zt && (xt == zc);
+            if (xc) x[wt] ^= bt;
+            if (zt) z[wc] ^= bc;
+        }
+    }
+
+    void cz(int control, int target) {
+        h(target);
+        cnot(control, target);
+        h(target);
+    }
+
+    // Measure qubit q in the Z basis and collapse the tableau onto the outcome
+    int measure(int q) {
+        check(q);
+        const size_t w = q / 64;
+        const uint64_t b = bit(q);
+        size_t p = n;
+        while (p < 2 * n && !(xs[p * words + w] & b)) ++p;
+
+        if (p < 2 * n) {
+            // A stabilizer anticommutes with Z_q: the outcome is uniformly random
+            for (size_t r = 0; r < 2 * n; ++r) {
+                if (r != p && (xs[r * words + w] & b)) rowsum(r, p);
+            }
+            copy_row(p - n, p);
+            std::fill(&xs[p * words], &xs[(p + 1) * words], 0);
+            std::fill(&zs[p * words], &zs[(p + 1) * words], 0);
+            zs[p * words + w] |= b;
+            signs[p] = gen() & 1;
+            return signs[p];
+        }
+
+        // Z_q is in the stabilizer group; its sign is the product of the stabilizers paired
+        // with the destabilizers that anticommute with it
+        const size_t scratch = 2 * n;
+        std::fill(&xs[scratch * words], &xs[(scratch + 1) * words], 0);
+        std::fill(&zs[scratch * words], &zs[(scratch + 1) * words], 0);
+        signs[scratch] = 0;
+        for (size_t r = 0; r < n; ++r) {
+            if (xs[r * words + w] & b) rowsum(scratch, r + n);
+        }
+        return signs[scratch];
+    }
+
+private:
+    static uint64_t bit(size_t q) { return uint64_t(1) << (q % 64); }
+
+    void check(int q) const {
+        if (q < 0 || size_t(q) >= n) {
+            throw std::out_of_range("Qubit index out of range.");
+        }
+    }
+
+    // Run update(x word, z word, sign, bit) on qubit q's word of every non-scratch row
+    template <typename Update>
+    void for_rows(int q, Update update) {
+        check(q);
+        const size_t w = q / 64;
+        const uint64_t b = bit(q);
+        for (size_t r = 0; r < 2 * n; ++r) {
+            update(xs[r * words + w], zs[r * words + w], signs[r], b);
+        }
+    }
+
+    void copy_row(size_t to, size_t from) {
+        std::copy(&xs[from * words], &xs[(from + 1) * words], &xs[to * words]);
+        std::copy(&zs[from * words], &zs[(from + 1) * words], &zs[to * words]);
+        signs[to] = signs[from];
+    }
+
+    // Row h <- row i * row h. The product's power of i is counted word by word: each qubit
+    // contributes +1, -1 or 0 (Aaronson-Gottesman's g function), collected with popcounts.
+    void rowsum(size_t h, size_t i) {
+        uint64_t* x2 = &xs[h * words];
+        uint64_t* z2 = &zs[h * words];
+        const uint64_t* x1 = &xs[i * words];
+        const uint64_t* z1 = &zs[i * words];
+        long power = 2 * signs[h] + 2 * signs[i];
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t a = x1[w], c = z1[w], b = x2[w], d = z2[w];
+            uint64_t plus = (a & c & ~b & d) | (a & ~c & b & d) | (~a & c & b & ~d);
+            uint64_t minus = (a & c & b & ~d) | (a & ~c & ~b & d) | (~a & c & b & d);
+            power += __builtin_popcountll(plus) - __builtin_popcountll(minus);
+            x2[w] ^= a;
+            z2[w] ^= c;
+        }
+        signs[h] = (((power % 4) + 4) % 4) == 2;
+    }
+
+    size_t n, words;
+    std::vector<uint64_t> xs, zs;
+    std::vector<uint8_t> signs;
+    std::mt19937_64 gen;
+};
+
+// Clifford circuits on a stabilizer tableau, with the same gate API as StateVector. Gates
+// equal (up to global phase) to one of the 24 single-qubit Cliffords run as H/S sequences on
+// the tableau; controlled X, Y and Z run as CNOT/CZ. The first other gate switches the
+// simulator to a StateVector, rebuilt by replaying the recorded operations and measurement
+// outcomes, which needs at most kMaxFallbackQubits qubits.
+class CliffordSimulator {
+public:
+    static constexpr int kMaxFallbackQubits = 30;
+
+    explicit CliffordSimulator(int num_qubits, uint64_t seed = std::random_device{}())
+        : qubits(num_qubits), tableau(num_qubits, seed), gen(seed ^ 0x9E3779B97F4A7C15ull) {}
+
+    int num_qubits() const { return qubits; }
+    bool using_state_vector() const { return state != nullptr; }
+
+    // Qubit indices are checked up front: an identity gate has an empty H/S sequence and
+    // would otherwise reach neither the tableau's nor the state vector's checks
+    void apply_gate(const Gate& gate, int target) {
+        check_qubit(target);
+        if (state) {
+            state->apply_gate(gate, target);
+            return;
+        }
+        const std::string* sequence = clifford_sequence(gate);
+        if (!sequence) {
+            fall_back();
+            state->apply_gate(gate, target);
+            return;
+        }
+        for (char op : *sequence) {
+            op == 'H' ? tableau.h(target) : tableau.s(target);
+        }
+        record({gate, target, -1, -1});
+    }
+
+    void apply_controlled_gate(const Gate& gate, int control, int target) {
+        check_qubit(control);
+        check_qubit(target);
+        if (control == target) {
+            throw std::invalid_argument("Control and target qubits must differ.");
+        }
+        if (state) {
+            state->apply_controlled_gate(gate, control, target);
+            return;
+        }
+        if (same_up_to_phase(gate, pauli_x_gate(), false)) {
+            tableau.cnot(control, target);
+        } else if (same_up_to_phase(gate, pauli_z_gate(), false)) {
+            tableau.cz(control, target);
+        } else if (same_up_to_phase(gate, pauli_y_gate(), false)) {
+            // CY = (I x S) CNOT (I x S^dagger)
+            tableau.s(target);
+            tableau.s(target);
+            tableau.s(target);
+            tableau.cnot(control, target);
+            tableau.s(target);
+        } else {
+            fall_back();
+            state->apply_controlled_gate(gate, control, target);
+            return;
+        }
+        record({gate, target, control, -1});
+    }
+
+    void apply_cnot(int control, int target) { apply_controlled_gate(pauli_x_gate(), control, target); }
+
+    // Measure one qubit in the Z basis, collapsing the state
+    int measure(int qubit) {
+        if (state) return int(state->measure({qubit}, gen()));
+        int outcome = tableau.measure(qubit);
+        record({identity_gate(), qubit, -1, outcome});
+        return outcome;
+    }
+
+private:
+    // A recorded step: a gate (outcome < 0) or a measurement of `target` with its outcome
+    struct Step {
+        Gate gate;
+        int target;
+        int control;
+        int outcome;
+    };
+
+    void check_qubit(int q) const {
+        if (q < 0 || q >= qubits) {
+            throw std::out_of_range("Qubit index out of range.");
+        }
+    }
+
+    void record(const Step& step) {
+        if (qubits <= kMaxFallbackQubits) history.push_back(step);
+    }
+
+    void fall_back() {
+        if (qubits > kMaxFallbackQubits) {
+            throw std::runtime_error("Non-Clifford gate on a circuit too large for the state-vector fallback.");
+        }
+        state.reset(new StateVector(qubits));
+        for (const Step& step : history) {
+            if (step.outcome >= 0) {
+                state->project(size_t(1) << step.target, size_t(step.outcome) << step.target);
+            } else if (step.control >= 0) {
+                state->apply_controlled_gate(step.gate, step.control, step.target);
+            } else {
+                state->apply_gate(step.gate, step.target);
+            }
+        }
+        history.clear();
+    }
+
+    // a == e^(i phi) b, with any phase when allow_phase, otherwise phi = 0
+    static bool same_up_to_phase(const Gate& a, const Gate& b, bool allow_phase = true) {
+        const double tolerance = 1e-9;
+        size_t k = 0;
+        for (size_t j = 1; j < 4; ++j) {
+            if (std::abs(b.m[j]) > std::abs(b.m[k])) k = j;
+        }
+        Amplitude phase = allow_phase ? a.m[k] / b.m[k] : Amplitude(1.0);
+        if (std::abs(std::abs(phase) - 1.0) > tolerance) return false;
+        for (size_t j = 0; j < 4; ++j) {
+            if (std::abs(a.m[j] - phase * b.m[j]) > tolerance) return false;
+        }
+        return true;
+    }
+
+    // H/S sequence (in application order) equal to the gate up to phase, or null if the gate
+    // is not Clifford. The 24 single-qubit Cliffords are enumerated once, breadth first.
+    static const std::string* clifford_sequence(const Gate& gate) {
+        static const std::vector<std::pair<Gate, std::string>> cliffords = [] {
+            std::vector<std::pair<Gate, std::string>> found = {{identity_gate(), ""}};
+            for (size_t i = 0; i < found.size(); ++i) {
+                for (char op : {'H', 'S'}) {
+                    Gate next = (op == 'H' ? hadamard_gate() : phase_gate(M_PI / 2)) * found[i].first;
+                    bool seen = std::any_of(found.begin(), found.end(),
+                                            [&](const auto& c) { return same_up_to_phase(next, c.first); });
+                    if (!seen) found.push_back({next, found[i].second + op});
+                }
+            }
+            return found;
+        }();
+        for (const auto& c : cliffords) {
+            if (same_up_to_phase(gate, c.first)) return &c.second;
+        }
+        return nullptr;
+    }
+
+    int qubits;
+    StabilizerTableau tableau;
+    std::mt19937_64 gen;
+    std::vector<Step> history;
+    std::unique_ptr<StateVector> state;
+};
+
+// Thin SVD M = U diag(s) V^dagger of a row-major rows x cols matrix, with singular values in
+// decreasing order. One-sided (Hestenes) Jacobi: pairs of columns are rotated until all are
+// orthogonal, so the column norms are the singular values; a wide matrix is handled through
+// its conjugate transpose. Accurate for the small (2 chi x 2 chi) blocks of the MPS backend.
+struct SvdResult {
+    size_t rank = 0;
+    std::vector<Amplitude> u;  // rows x rank
+    std::vector<double> s;     // rank
+    std::vector<Amplitude> vh; // rank x cols
+};
+
+SvdResult jacobi_svd(const std::vector<Amplitude>& matrix, size_t rows, size_t cols) {
+    const bool transpose = rows < cols;
+    const size_t m = transpose ? cols : rows, n = transpose ? rows : cols;
+
+    // Column-major m x n working copy of the matrix, or of its conjugate transpose
+    std::vector<Amplitude> a(m * n), v(n * n, 0.0);
+    for (size_t i = 0; i < rows; ++i) {
+        for (size_t j = 0; j < cols; ++j) {
+            if (transpose) {
+                a[i * m + j] = std::conj(matrix[i * cols + j]);
+            } else {
+                a[j * m + i] = matrix[i * cols + j];
+            }
+        }
+    }
+    for (size_t j = 0; j < n; ++j) v[j * n + j] = 1.0;
+
+    for (int sweep = 0; sweep < 60; ++sweep) {
+        bool rotated = false;
+        for (size_t p = 0; p + 1 < n; ++p) {
+            for (size_t q = p + 1; q < n; ++q) {
+                Amplitude* ap = &a[p * m];
+                Amplitude* aq = &a[q * m];
+                double alpha = 0.0, beta = 0.0;
+                Amplitude gamma = 0.0;
+                for (size_t i = 0; i < m; ++i) {
+                    alpha += std::norm(ap[i]);
+                    beta += std::norm(aq[i]);
+                    gamma += std::conj(ap[i]) * aq[i];
+                }
+                const double g = std::abs(gamma);
+                if (g == 0.0 || g <= 1e-15 * std::sqrt(alpha * beta)) continue;
+                rotated = true;
+
+                // Rotate (a_p, e a_q), where the phase e makes <a_p, e a_q> real, by the angle
+                // that zeroes their inner product; V receives the same column operation
+                const double zeta = (beta - alpha) / (2.0 * g);
+                const double t = (zeta >= 0.0 ? 1.0 : -1.0) / (std::abs(zeta) + std::sqrt(1.0 + zeta * zeta));
+                const double c = 1.0 / std::sqrt(1.0 + t * t), sn = c * t;
+                const Amplitude e = std::conj(gamma) / g;
+                for (size_t i = 0; i < m; ++i) {
+                    Amplitude x = ap[i], y = aq[i] * e;
+                    ap[i] = c * x - sn * y;
+                    aq[i] = sn * x + c * y;
+                }
+                Amplitude* vp = &v[p * n];
+                Amplitude* vq = &v[q * n];
+                for (size_t i = 0; i < n; ++i) {
+                    Amplitude x = vp[i], y = vq[i] * e;
+                    vp[i] = c * x - sn * y;
+                    vq[i] = sn * x + c * y;
+                }
+            }
+        }
+        if (!rotated) break;
+    }
+
+    std::vector<double> norms(n);
+    for (size_t j = 0; j < n; ++j) {
+        double sum = 0.0;
+        for (size_t i = 0; i < m; ++i) sum += std::norm(a[j * m + i]);
+        norms[j] = std::sqrt(sum);
+    }
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y) { return norms[x] > norms[y]; });
+
+    // The working matrix is now (left vectors) * diag(s); V holds the right vectors
+    SvdResult result;
+    result.rank = n;
+    result.s.resize(n);
+    result.u.assign(rows * n, 0.0);
+    result.vh.assign(n * cols, 0.0);
+    for (size_t k = 0; k < n; ++k) {
+        const size_t j = order[k];
+        const double sigma = norms[j];
+        result.s[k] = sigma;
+        const double inverse = sigma > 0.0 ? 1.0 / sigma : 0.0;
+        for (size_t i = 0; i < m; ++i) {
+            Amplitude left = a[j * m + i] * inverse;
+            if (transpose) {
+                result.vh[k * cols + i] = std::conj(left); // M^dagger = U' S V'^dagger, so V = U'
+            } else {
+                result.u[i * n + k] = left;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (transpose) {
+                result.u[i * n + k] = v[j * n + i];
+            } else {
+                result.vh[k * cols + i] = std::conj(v[j * n + i]);
+            }
+        }
+    }
+    return result;
+}
+
+// Matrix product state: qubit q is site q, a tensor A[q](left, s, right) with bond dimensions
+// capped at max_bond, so memory is O(N chi^2) instead of 2^N. Same gate API as StateVector:
+// single-qubit gates contract into one site; a controlled gate on neighbouring sites
+// contracts both sites, applies the 4x4 gate and splits them again with a truncated SVD
+// keeping at most max_bond singular values. Distant qubits are first brought together with
+// SWAPs and moved back afterwards. The state is kept in mixed canonical form around
+// `center`, so each split's discarded squared singular values are exactly the squared error
+// of that truncation; truncation_error() reports their sum, and kept values are renormalized.
+class MatrixProductState {
+public:
+    explicit MatrixProductState(int num_qubits, size_t max_bond = 64)
+        : qubits(num_qubits), chi(max_bond), sites(num_qubits) {
+        if (num_qubits < 1 || max_bond < 1) {
+            throw std::invalid_argument("MatrixProductState needs at least one qubit and bond dimension 1.");
+        }
+        for (auto& site : sites) {
+            site = {1, 1, {1.0, 0.0}}; // |0>
+        }
+    }
+
+    int num_qubits() const { return qubits; }
+    size_t max_bond() const { return chi; }
+    double truncation_error() const { return discarded; }
+
+    // Bond dimension between sites q and q + 1
+    size_t bond_dimension(int q) const { return sites[q].right; }
+
+    size_t memory_bytes() const {
+        size_t total = 0;
+        for (const auto& site : sites) total += site.data.size() * sizeof(Amplitude);
+        return total;
+    }
+
+    void apply_gate(const Gate& gate, int target) {
+        check_qubit(target);
+        Site& site = sites[target];
+        for (size_t l = 0; l < site.left; ++l) {
+            for (size_t r = 0; r < site.right; ++r) {
+                Amplitude a0 = site.at(l, 0, r), a1 = site.at(l, 1, r);
+                site.at(l, 0, r) = gate.m[0] * a0 + gate.m[1] * a1;
+                site.at(l, 1, r) = gate.m[2] * a0 + gate.m[3] * a1;
+            }
+        }
+    }
+
+    void apply_controlled_gate(const Gate& gate, int control, int target) {
+        check_qubit(control);
+        check_qubit(target);
+        if (control == target) {
+            throw std::invalid_argument("Control and target qubits must differ.");
+        }
+        // Walk the control next to the target, apply, and walk it back
+        const int step = control < target ? 1 : -1;
+        int position = control;
+        for (; position + step != target; position += step) {
+            apply_two_site(std::min(position, position + step), swap_matrix());
+        }
+        apply_two_site(std::min(position, target), controlled_matrix(gate, position < target));
+        for (; position != control; position -= step) {
+            apply_two_site(std::min(position, position - step), swap_matrix());
+        }
+    }
+
+    void apply_cnot(int control, int target) { apply_controlled_gate(pauli_x_gate(), control, target); }
+
+    // <bits|psi>, with bits[q] the value of qubit q
+    Amplitude amplitude(const std::vector<int>& bits) const {
+        std::vector<Amplitude> row = {1.0};
+        for (int q = 0; q < qubits; ++q) {
+            const Site& site = sites[q];
+            std::vector<Amplitude> next(site.right, 0.0);
+            for (size_t l = 0; l < site.left; ++l) {
+                for (size_t r = 0; r < site.right; ++r) {
+                    next[r] += row[l] * site.at(l, bits[q], r);
+                }
+            }
+            row.swap(next);
+        }
+        return row[0];
+    }
+
+private:
+    struct Site {
+        size_t left, right;
+        std::vector<Amplitude> data; // (l * 2 + s) * right + r
+
+        Amplitude& at(size_t l, size_t s, size_t r) { return data[(l * 2 + s) * right + r]; }
+        const Amplitude& at(size_t l, size_t s, size_t r) const { return data[(l * 2 + s) * right + r]; }
+    };
+
+    using Matrix4 = std::array<Amplitude, 16>; // Row-major over (s1 s2), s1 on the left site
+
+    static Matrix4 swap_matrix() {
+        Matrix4 m{};
+        m[0 * 4 + 0] = m[1 * 4 + 2] = m[2 * 4 + 1] = m[3 * 4 + 3] = 1.0;
+        return m;
+    }
+
+    // Controlled gate with the control on the left site (or the right one)
+    static Matrix4 controlled_matrix(const Gate& gate, bool control_left) {
+        Matrix4 m{};
+        for (int x = 0; x < 2; ++x) {
+            for (int y = 0; y < 2; ++y) {
+                int row0 = control_left ? 0 * 2 + x : x * 2 + 0, col0 = control_left ? 0 * 2 + y : y * 2 + 0;
+                int row1 = control_left ? 1 * 2 + x : x * 2 + 1, col1 = control_left ? 1 * 2 + y : y * 2 + 1;
+                m[row0 * 4 + col0] = x == y ? 1.0 : 0.0;
+                m[row1 * 4 + col1] = gate.m[x * 2 + y];
+            }
+        }
+        return m;
+    }
+
+    void check_qubit(int q) const {
+        if (q < 0 || q >= qubits) {
+            throw std::out_of_range("Qubit index out of range.");
+        }
+    }
+
+    // Move the orthogonality center to site q by splitting sites with exact (untruncated) SVDs
+    void move_center(int q) {
+        while (center < q) {
+            Site& site = sites[center];
+            SvdResult svd = jacobi_svd(site.data, site.left * 2, site.right);
+            size_t k = kept_rank(svd, svd.rank);
+            Site& next = sites[center + 1];
+            // next <- (S V^dagger) next
+            std::vector<Amplitude> merged(k * 2 * next.right, 0.0);
+            for (size_t a = 0; a < k; ++a) {
+                for (size_t b = 0; b < site.right; ++b) {
+                    Amplitude w = svd.s[a] * svd.vh[a * site.right + b];
+                    if (w == 0.0) continue;
+                    for (size_t sr = 0; sr < 2 * next.right; ++sr) merged[a * 2 * next.right + sr] += w * next.data[b * 2 * next.right + sr];
+                }
+            }
+            site.data = take_columns(svd.u, site.left * 2, svd.rank, k);
+            site.right = k;
+            next.data.swap(merged);
+            next.left = k;
+            ++center;
+        }
+        while (center > q) {
+            Site& site = sites[center];
+            SvdResult svd = jacobi_svd(site.data, site.left, 2 * site.right);
+            size_t k = kept_rank(svd, svd.rank);
+            Site& prev = sites[center - 1];
+            // prev <- prev (U S)
+            std::vector<Amplitude> merged(prev.left * 2 * k, 0.0);
+            for (size_t ls = 0; ls < prev.left * 2; ++ls) {
+                for (size_t b = 0; b < site.left; ++b) {
+                    Amplitude w = prev.data[ls * site.left + b];
+                    if (w == 0.0) continue;
+                    for (size_t a = 0; a < k; ++a) merged[ls * k + a] += w * svd.u[b * svd.rank + a] * svd.s[a];
+                }
+            }
+            site.data.assign(svd.vh.begin(), svd.vh.begin() + k * 2 * site.right);
+            site.left = k;
+            prev.data.swap(merged);
+            prev.right = k;
+            --center;
+        }
+    }
+
+    // Apply a 4x4 gate to sites q and q + 1 and split them again, truncating to max_bond
+    void apply_two_site(int q, const Matrix4& gate) {
+        move_center(q);
+        Site& a = sites[q];
+        Site& b = sites[q + 1];
+        const size_t left = a.left, right = b.right, bond = a.right;
+
+        // theta(l, s1, s2, r) = sum_m A(l, s1, m) B(m, s2, r), then the gate on (s1, s2)
+        std::vector<Amplitude> theta(left * 4 * right, 0.0);
+        for (size_t l = 0; l < left; ++l) {
+            for (size_t s1 = 0; s1 < 2; ++s1) {
+                for (size_t m = 0; m < bond; ++m) {
+                    Amplitude w = a.at(l, s1, m);
+                    if (w == 0.0) continue;
+                    for (size_t s2 = 0; s2 < 2; ++s2) {
+                        for (size_t r = 0; r < right; ++r) {
+                            theta[((l * 2 + s1) * 2 + s2) * right + r] += w * b.at(m, s2, r);
+                        }
+                    }
+                }
+            }
+        }
+        std::vector<Amplitude> updated(theta.size(), 0.0);
+        for (size_t l = 0; l < left; ++l) {
+            for (size_t out = 0; out < 4; ++out) {
+                for (size_t in = 0; in < 4; ++in) {
+                    Amplitude g = gate[out * 4 + in];
+                    if (g == 0.0) continue;
+                    for (size_t r = 0; r < right; ++r) {
+                        updated[(l * 4 + out) * right + r] += g * theta[(l * 4 + in) * right + r];
+                    }
+                }
+            }
+        }
+
+        // Split (l s1) x (s2 r): A = U (left-orthonormal), B = S V^dagger (new center)
+        SvdResult svd = jacobi_svd(updated, left * 2, 2 * right);
+        size_t k = kept_rank(svd, std::min(chi, svd.rank));
+        a.data = take_columns(svd.u, left * 2, svd.rank, k);
+        a.right = k;
+        b.data.assign(k * 2 * right, 0.0);
+        for (size_t i = 0; i < k; ++i) {
+            for (size_t j = 0; j < 2 * right; ++j) b.data[i * 2 * right + j] = svd.s[i] * svd.vh[i * 2 * right + j];
+        }
+        b.left = k;
+        center = q + 1;
+    }
+
+    // Number of singular values kept: at most `limit`, dropping negligible ones; the dropped
+    // weight is added to the truncation error and the kept values are renormalized to the
+    // original norm
+    size_t kept_rank(SvdResult& svd, size_t limit) {
+        double total = 0.0;
+        for (double v : svd.s) total += v * v;
+        size_t k = std::max<size_t>(1, limit);
+        while (k > 1 && svd.s[k - 1] * svd.s[k - 1] <= 1e-28 * total) --k;
+        double kept = 0.0;
+        for (size_t i = 0; i < k; ++i) kept += svd.s[i] * svd.s[i];
+        if (total > 0.0 && kept < total) {
+            discarded += (total - kept) / total;
+            const double scale = std::sqrt(total / kept);
+            for (size_t i = 0; i < k; ++i) svd.s[i] *= scale;
+        }
+        return k;
+    }
+
+    // First k columns of a rows x cols row-major matrix
+    static std::vector<Amplitude> take_columns(const std::vector<Amplitude>& m, size_t rows, size_t cols, size_t k) {
+        std::vector<Amplitude> out(rows * k);
+        for (size_t i = 0; i < rows; ++i) {
+            std::copy(m.begin() + i * cols, m.begin() + i * cols + k, out.begin() + i * k);
+        }
+        return out;
+    }
+
+    int qubits;
+    size_t chi;
+    std::vector<Site> sites;
+    int center = 0;
+    double discarded = 0.0;
+};
+
+// Reversible classical circuit simulated bit-sliced: bit b of every shot lives in one
+// 512-bit block (8 words; shot k of the block is bit k % 64 of word k / 64), so each gate is a
+// handful of word-wide XOR/AND operations covering 512 shots, which the compiler maps onto
+// AVX-512 or AVX2 registers. Blocks are spread over the thread pool.
+class BitSlicedCircuit {
+public:
+    static constexpr size_t kWords = 8;
+    static constexpr size_t kShotsPerBlock = 64 * kWords;
+    // Largest bit count for which run() can build a full outcome histogram
+    static constexpr int kMaxHistogramBits = 24;
+
+    // Per-bit counts of ones and, when requested, counts of every outcome (bit b of the index
+    // is bit b of the shot)
+    struct ShotCounts {
+        uint64_t shots = 0;
+        std::vector<uint64_t> ones;
+        std::vector<uint64_t> histogram;
+    };
+
+    explicit BitSlicedCircuit(int num_bits) : bits(num_bits), random_start(num_bits, false) {
+        if (num_bits < 1) {
+            throw std::invalid_argument("BitSlicedCircuit needs at least one bit.");
+        }
+    }
+
+    int num_bits() const { return bits; }
+
+    // Start `bit` as a fair coin in every shot instead of 0
+    BitSlicedCircuit& randomize(int bit) {
+        check(bit);
+        random_start[bit] = true;
+        return *this;
+    }
+
+    BitSlicedCircuit& add_not(int target) { return add(Kind::Not, -1, -1, target); }
+    BitSlicedCircuit& add_cnot(int control, int target) { return add(Kind::Cnot, control, -1, target); }
+    BitSlicedCircuit& add_toffoli(int control1, int control2, int target) {
+        return add(Kind::Toffoli, control1, control2, target);
+    }
+    BitSlicedCircuit& add_swap(int a, int b) { return add(Kind::Swap, a, -1, b); }
+
+    // Run `shots` independent shots. Random starting bits come from a counter-based hash of
+    // (seed, shot block, bit), so the counts depend only on the seed, not on the threads.
+    ShotCounts run(uint64_t shots, uint64_t seed, bool histogram = false) const {
+        if (histogram && bits > kMaxHistogramBits) {
+            throw std::invalid_argument("Too many bits for a full outcome histogram.");
+        }
+        ShotCounts total;
+        total.shots = shots;
+        total.ones.assign(bits, 0);
+        if (histogram) total.histogram.assign(size_t(1) << bits, 0);
+
+        std::mutex merge;
+        const size_t num_blocks = (shots + kShotsPerBlock - 1) / kShotsPerBlock;
+        ThreadPool::instance().parallel_for(num_blocks, 16, [&](size_t begin, size_t end) {
+            ShotCounts local;
+            local.ones.assign(bits, 0);
+            if (histogram) local.histogram.assign(size_t(1) << bits, 0);
+            std::vector<Block> state(bits);
+            for (size_t block = begin; block < end; ++block) {
+                run_block(block, seed, state);
+
+                // Lanes past the last shot are masked out of the counts
+                Block valid;
+                const uint64_t first_shot = block * kShotsPerBlock;
+                for (size_t w = 0; w < kWords; ++w) {
+                    uint64_t start = first_shot + 64 * w;
+                    valid.w[w] = start >= shots ? 0 : shots - start >= 64 ? ~uint64_t(0) : (uint64_t(1) << (shots - start)) - 1;
+                }
+                for (int b = 0; b < bits; ++b) {
+                    for (size_t w = 0; w < kWords; ++w) local.ones[b] += __builtin_popcountll(state[b].w[w] & valid.w[w]);
+                }
+                if (histogram) {
+                    for (size_t w = 0; w < kWords; ++w) {
+                        for (uint64_t lanes = valid.w[w]; lanes; lanes &= lanes - 1) {
+                            int lane = __builtin_ctzll(lanes);
+                            size_t outcome = 0;
+                            for (int b = 0; b < bits; ++b) outcome |= size_t((state[b].w[w] >> lane) & 1) << b;
+                            ++local.histogram[outcome];
+                        }
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            for (int b = 0; b < bits; ++b) total.ones[b] += local.ones[b];
+            for (size_t i = 0; i < local.histogram.size(); ++i) total.histogram[i] += local.histogram[i];
+        });
+        return total;
+    }
+
+private:
+    enum class Kind { Not, Cnot, Toffoli, Swap };
+
+    struct Step {
+        Kind kind;
+        int a, b, target;
+    };
+
+    struct alignas(64) Block {
+        uint64_t w[kWords];
+    };
+
+    BitSlicedCircuit& add(Kind kind, int a, int b, int target) {
+        check(target);
+        if (a >= 0) check(a);
+        if (b >= 0) check(b);
+        if (a == target || b == target) {
+            throw std::invalid_argument("Gate bits must differ.");
+        }
+        steps.push_back({kind, a, b, target});
+        return *this;
+    }
+
+    void check(int bit) const {
+        if (bit < 0 || bit >= bits) {
+            throw std::out_of_range("Bit index out of range.");
+        }
+    }
+
+    // splitmix64 finalizer
+    static uint64_t mix(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    // One splitmix64 output per random word: the stream keyed by the seed, at the word's
+    // position (block, bit, word)
+    void run_block(size_t block, uint64_t seed, std::vector<Block>& state) const {
+        const uint64_t key = mix(seed);
+        for (int b = 0; b < bits; ++b) {
+            for (size_t w = 0; w < kWords; ++w) {
+                uint64_t counter = (uint64_t(block) * bits + b) * kWords + w;
+                state[b].w[w] = random_start[b] ? mix(key + counter * 0x9E3779B97F4A7C15ull) : 0;
+            }
+        }
+        for (const Step& step : steps) {
+            uint64_t* t = state[step.target].w;
+            switch (step.kind) {
+            case Kind::Not:
+                for (size_t w = 0; w < kWords; ++w) t[w] = ~t[w];
+                break;
+            case Kind::Cnot: {
+                const uint64_t* c = state[step.a].w;
+                for (size_t w = 0; w < kWords; ++w) t[w] ^= c[w];
+                break;
+            }
+            case Kind::Toffoli: {
+                const uint64_t* c1 = state[step.a].w;
+                const uint64_t* c2 = state[step.b].w;
+                for (size_t w = 0; w < kWords; ++w) t[w] ^= c1[w] & c2[w];
+                break;
+            }
+            case Kind::Swap:
+                std::swap(state[step.a], state[step.target]);
+                break;
+            }
+        }
+    }
+
+    int bits;
+    std::vector<bool> random_start;
+    std::vector<Step> steps;
+};
 
 // Function to simulate a random superposition (hyperdimensional algorithm part)
+// Prepares a random normalized superposition of N qubits and applies k layers of the
+// hyperdimensional operator: a Hadamard on every qubit followed by a CNOT chain.
 std::vector<std::complex<double>> hyperdimensional_algorithm(int N, int k) {
-    int dimension = std::pow(2, N); // 2^N dimension Hilbert space
-    std::vector<std::complex<double>> hilbert_space(dimension, {0.0, 0.0});
-    std::vector<std::complex<double>> superposition(dimension);
+    StateVector state(N);
 
     // Random number generation for superposition
     std::random_device rd;
@@ -16,47 +2119,60 @@ std::vector<std::complex<double>> hyperdimensional_algorithm(int N, int k) {
     std::uniform_real_distribution<> dis(0.0, 1.0);
 
     // Generate a random superposition of basis vectors
-    for (int i = 0; i < dimension; ++i) {
-        superposition[i] = {dis(gen), dis(gen)};
+    for (size_t i = 0; i < state.size(); ++i) {
+        state[i] = {dis(gen), dis(gen)};
     }
+    state.normalize();
 
-    // Apply the hyperdimensional operator (identity for simplicity)
-    for (int i = 0; i < N; ++i) {
-        for (int j = 0; j < dimension; ++j) {
-            superposition[j] = superposition[j];  // Identity, no change
+    // Apply the hyperdimensional operator k times
+    Circuit circuit(N);
+    for (int layer = 0; layer < k; ++layer) {
+        for (int q = 0; q < N; ++q) {
+            circuit.add(hadamard_gate(), q);
+        }
+        for (int q = 0; q + 1 < N; ++q) {
+            circuit.add_cnot(q, q + 1);
         }
     }
+    circuit.fused().run(state);
 
-    // Project the superposition onto the Hilbert space
-    for (int i = 0; i < dimension; ++i) {
-        hilbert_space[i] = std::conj(hilbert_space[i]) * superposition[i];
-    }
-
-    return hilbert_space; // Returns the projection result
+    return std::vector<std::complex<double>>(state.data(), state.data() + state.size()); // Returns the evolved amplitudes
 }
 
 // Function to simulate a quantum circuit (basic version)
+// Hadamard on every qubit, then a ring of CNOTs from each qubit to the next, then a
+// measurement of all qubits. The circuit is Clifford, so it runs on the stabilizer tableau
+// and N is not limited by state-vector memory.
 std::vector<int> quantum_circuit(int N) {
-    std::vector<int> qubits(N, 0); // N qubits initialized to 0
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 1);
-
-    // Apply a Hadamard-like operation (randomizing qubit states)
+    CliffordSimulator simulator(N); // N qubits initialized to 0
     for (int i = 0; i < N; ++i) {
-        qubits[i] = dis(gen); // Random 0 or 1 to simulate Hadamard
+        simulator.apply_gate(hadamard_gate(), i);
     }
-
-    // Apply CNOT-like operations (for simplicity, we'll flip the next qubit if current is 1)
     for (int i = 0; i < N; ++i) {
-        if (qubits[i] == 1) {
-            qubits[(i + 1) % N] = 1 - qubits[(i + 1) % N]; // Flip the next qubit
-        }
+        if ((i + 1) % N != i) simulator.apply_cnot(i, (i + 1) % N);
     }
 
+    std::vector<int> qubits(N);
+    for (int i = 0; i < N; ++i) {
+        qubits[i] = simulator.measure(i);
+    }
     return qubits; // Return the final qubit states after measurement
 }
 
+// Outcome counts of quantum_circuit(N) over many shots. The CNOT ring only permutes basis
+// states and the Hadamard layer makes them uniform, so sampling is the same as flipping the
+// next bit of uniformly random bits, which the bit-sliced engine does 512 shots at a time.
+BitSlicedCircuit::ShotCounts quantum_circuit_counts(int N, uint64_t shots, uint64_t seed, bool histogram = true) {
+    BitSlicedCircuit circuit(N);
+    for (int i = 0; i < N; ++i) {
+        circuit.randomize(i);
+    }
+    for (int i = 0; i < N; ++i) {
+        if ((i + 1) % N != i) circuit.add_cnot(i, (i + 1) % N); // Flip the next qubit
+    }
+    return circuit.run(shots, seed, histogram && N <= BitSlicedCircuit::kMaxHistogramBits);
+}
+
 int main() {
     int N = 5; // Number of qubits
     int k = 10; // Iterations or operations
@@ -81,5 +2197,11 @@ int main() {
     }
     std::cout << std::endl;
 
+    // Outcome frequencies of the same circuit over a million shots
+    BitSlicedCircuit::ShotCounts counts = quantum_circuit_counts(N, 1 << 20, std::random_device{}());
+    size_t most_common = std::max_element(counts.histogram.begin(), counts.histogram.end()) - counts.histogram.begin();
+    std::cout << "Most frequent outcome over " << counts.shots << " shots: " << most_common << " ("
+              << counts.histogram[most_common] << " times)" << std::endl;
+
     return 0;
 }